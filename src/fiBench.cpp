@@ -0,0 +1,190 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Name:        src/fiBench.cpp
+ * Project:     fill: Private utility to create Matthews TFP database
+ * Purpose:     Timing of the xml loading and processing stages.
+ * Author:      Nick Matthews
+ * Website:     http://thefamilypack.org
+ * Created:     18th October 2026
+ * Copyright:   Copyright (c) 2026, Nick Matthews.
+ * Licence:     GNU GPLv3
+ *
+ *  tfpnick is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tfpnick is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tfpnick.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+*/
+
+#include "wx/wxprec.h"
+
+#ifdef __BORLANDC__
+    #pragma hdrstop
+#endif
+
+#ifndef WX_PRECOMP
+#include "wx/wx.h"
+#endif
+
+#include <wx/dir.h>
+#include <wx/stopwatch.h>
+#include <wx/wfstream.h>
+
+#include "nkMain.h"
+#include "xml2.h"
+
+const int BenchPasses = 5;
+
+// Collect the same set of files that InputRefFiles reads.
+bool BenchGetRefFiles( const wxString& refFolder, wxArrayString& files )
+{
+    wxDir dir( refFolder );
+    if( !dir.IsOpened() ) {
+        return false;
+    }
+    wxString rddirname;
+    bool cont = dir.GetFirst( &rddirname, "rd??", wxDIR_DIRS );
+    while( cont ) {
+        wxString rdpath = refFolder + "/" + rddirname;
+        wxDir rddir( rdpath );
+        wxString rdfilename;
+        bool fcont = rddir.IsOpened()
+            && rddir.GetFirst( &rdfilename, "rd?????.htm", wxDIR_FILES );
+        while( fcont ) {
+            files.push_back( rdpath + "/" + rdfilename );
+            fcont = rddir.GetNext( &rdfilename );
+        }
+        cont = dir.GetNext( &rddirname );
+    }
+    return true;
+}
+
+// The wxWidgets load, 1024 bytes read and parsed at a time, to compare
+// the others with.
+bool BenchLoadChunks( const wxString& path )
+{
+    wxFileInputStream stream( path );
+    wxXmlDocument doc;
+    return stream.IsOk()
+        && doc.Load( stream, "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES | wxXMLDOC_READ_CHUNKS );
+}
+
+bool BenchLoadStream( const wxString& path )
+{
+    wxFileInputStream stream( path );
+    wxXmlDocument doc;
+    return stream.IsOk()
+        && doc.Load( stream, "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES );
+}
+
+bool BenchLoadFile( const wxString& path )
+{
+    wxXmlDocument doc;
+    return doc.Load( path, "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES );
+}
+
+bool BenchLoadNative( const wxString& path )
+{
+    wxXmlParserKind kind = wxXmlDocument::GetParser();
+    wxXmlDocument::SetParser( wxXML_PARSER_NATIVE );
+    wxXmlDocument doc;
+    bool ok = doc.Load( path, "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES );
+    wxXmlDocument::SetParser( kind );
+    return ok;
+}
+
+typedef bool (*BenchLoader)( const wxString& path );
+
+// Count the files where the native tokenizer's tree, saved, is not the
+// same as expat's. Files expat can't read are counted separately.
+void BenchCompareParsers( const wxArrayString& files )
+{
+    wxXmlParserKind kind = wxXmlDocument::GetParser();
+    size_t differ = 0, expatOnly = 0, nativeOnly = 0;
+    for( size_t i = 0 ; i < files.size() ; i++ ) {
+        wxXmlDocument expat, native;
+        wxXmlDocument::SetParser( wxXML_PARSER_EXPAT );
+        bool expatOk = expat.Load( files[i], "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES );
+        wxXmlDocument::SetParser( wxXML_PARSER_NATIVE );
+        bool nativeOk = native.Load( files[i], "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES );
+        if( expatOk && nativeOk ) {
+            std::string expatOut, nativeOut;
+            expat.Save( expatOut );
+            native.Save( nativeOut );
+            if( expatOut != nativeOut ) {
+                differ++;
+            }
+        } else if( expatOk ) {
+            expatOnly++;
+        } else if( nativeOk ) {
+            nativeOnly++;
+        }
+    }
+    wxXmlDocument::SetParser( kind );
+    wxPrintf( "  native differs from expat: %lu, only expat read: %lu, only native read: %lu\n",
+        (unsigned long) differ, (unsigned long) expatOnly, (unsigned long) nativeOnly );
+}
+
+void BenchTimeLoader( const wxString& name, BenchLoader loader, const wxArrayString& files )
+{
+    // The first pass is untimed, it only gets the files into the OS cache.
+    for( size_t i = 0 ; i < files.size() ; i++ ) {
+        loader( files[i] );
+    }
+    long best = -1;
+    size_t failed = 0;
+    for( int pass = 0 ; pass < BenchPasses ; pass++ ) {
+        failed = 0;
+        wxStopWatch sw;
+        for( size_t i = 0 ; i < files.size() ; i++ ) {
+            if( !loader( files[i] ) ) {
+                failed++;
+            }
+        }
+        long ms = sw.Time();
+        if( best < 0 || ms < best ) {
+            best = ms;
+        }
+    }
+    wxPrintf( "  %-8s best of %d: %6ldms", name, BenchPasses, best );
+    if( failed ) {
+        wxPrintf( " (%lu failed)", (unsigned long) failed );
+    }
+    wxPrintf( "\n" );
+}
+
+void BenchmarkXmlLoad( const wxString& refFolder )
+{
+    wxArrayString files;
+    if( !BenchGetRefFiles( refFolder, files ) || files.empty() ) {
+        wxPrintf( "No reference documents found in [%s]\n", refFolder );
+        return;
+    }
+    wxULongLong bytes = 0;
+    for( size_t i = 0 ; i < files.size() ; i++ ) {
+        bytes += wxFileName::GetSize( files[i] );
+    }
+    wxPrintf( "\nLoading %lu files, %s bytes\n",
+        (unsigned long) files.size(), bytes.ToString() );
+
+    wxLogNull nolog; // Parse errors are counted, not reported.
+    wxXmlParserKind kind = wxXmlDocument::GetParser();
+    wxXmlDocument::SetParser( wxXML_PARSER_EXPAT );
+    BenchTimeLoader( "chunks", BenchLoadChunks, files );
+    BenchTimeLoader( "stream", BenchLoadStream, files );
+    BenchTimeLoader( "file", BenchLoadFile, files );
+    BenchTimeLoader( "native", BenchLoadNative, files );
+    BenchCompareParsers( files );
+    wxXmlDocument::SetParser( kind );
+}
+
+// End of src/fiBench.cpp file
@@ -98,52 +98,38 @@ wxString FindTitle( const wxString& note, const wxString& imStr )
     return note.substr( pos, pos2 - pos );
 }
 
-idt CreateMediaEvent( recReference& ref )
+idt CreateMediaEvent( idt refID, const std::string& statement, ReferenceWriter& writer )
 {
-    idt refID = ref.FGetID();
     idt eaID = CreateMediaEventa( refID );
 
-    wxStringInputStream statement( ref.FGetStatement() );
-    wxXmlDocument doc( statement );
-    wxXmlNode* node = doc.GetRoot();
-    idt indID;
+    wxXmlDocument doc;
+    doc.Load( statement.data(), statement.length(), "UTF-8", wxXMLDOC_INDEX_ANCHORS );
+    xmlAnchorIndex anchors( doc );
+    xmlLinkEdits edits;
     int seq = 0;
-    std::vector<wxXmlNode*> level;
-    while( node ) {
-        if( node->GetName() == "a" ) {
-            wxString href = node->GetAttribute( "href" );
-            if( DecodeHref( href, &indID, nullptr ) ) {
-                idt namID = CreateName( xmlGetAllContent( node ) );
-                recReferenceEntity::Create( refID, recReferenceEntity::TYPE_Name, namID, &seq );
-                Sex sex = recIndividual::GetSex( indID );
-                idt perID = CreatePersona( refID, indID, namID, sex );
-                AddPersonaToEventa( eaID, perID, recEventTypeRole::ROLE_Media_Subject );
-                wxString perIdStr = wxString::Format( "tfpr:Pa" ID, perID );
-                xmlChangeLink( node, perIdStr );
-            }
-        }
-        wxXmlNode* next = node->GetChildren();
-        if( next ) {
-            level.push_back( node );
-        }
-        else {
-            next = node->GetNext();
-            while( !next && !level.empty() ) {
-                next = level.back();
-                level.pop_back();
-                next = next->GetNext();
-            }
-        }
-        node = next;
+    for( size_t i = 0 ; i < anchors.size() ; i++ ) {
+        const xmlAnchor& a = anchors[i];
+        if( a.entity != recENT_Individual || a.id < 1 ) continue;
+        idt namID = CreateName( xmlGetAllContent( a.node ) );
+        recReferenceEntity::Create( refID, recReferenceEntity::TYPE_Name, namID, &seq );
+        Sex sex = recIndividual::GetSex( a.id );
+        idt perID = CreatePersona( refID, a.id, namID, sex );
+        AddPersonaToEventa( eaID, perID, recEventTypeRole::ROLE_Media_Subject );
+        edits.change( a.node, recENT_Persona, perID );
     }
-    wxStringOutputStream sos;
-    doc.Save( sos, wxXML_NO_INDENTATION, wxXMLDOC_SAVE_NONE );
-    ref.FSetStatement( sos.GetString() );
-    ref.Save();
+    edits.apply();
+    if( g_minify ) {
+        xmlMinify( doc.GetDocumentNode() );
+    }
+    // The links name personas of this reference, so the statement is only
+    // complete once the reference is saved.
+    std::string statementStr;
+    doc.Save( statementStr );
+    writer.update( refID, statementStr );
     return CreateEventFromEventa( eaID );
 }
 
-void CreateImage( long entry, idt galID, const wxString&  imgFolder, idt assID )
+void CreateImage( long entry, idt galID, const wxString&  imgFolder, idt assID, ReferenceWriter& writer )
 {
     wxFileName txtfilename( GetImageTextFileName( entry, imgFolder ) );
     txtfilename.MakeAbsolute();
@@ -174,12 +160,14 @@ void CreateImage( long entry, idt galID, const wxString&  imgFolder, idt assID )
     recReference ref( 0 );
     ref.FSetHigherID( 0 );
     ref.FSetTitle( "Photo of " + title );
-    ref.FSetStatement( "<!-- HTML -->\n<div class='img-text'>\n" + content + "</div>\n" );
     ref.FSetResID( 1 );
     ref.FSetUserRef( "Im" + recGetStr( entry ) );
     ref.CreateUidChanged();
     ref.Save();
-    idt eveID = CreateMediaEvent( ref );
+    std::string statement = "<!-- HTML -->\n<div class='img-text'>\n";
+    statement += content.utf8_str();
+    statement += "</div>\n";
+    idt eveID = CreateMediaEvent( ref.FGetID(), statement, writer );
 
     recMediaData md( 0 );
     md.FSetTitle( title );
@@ -213,20 +201,22 @@ void CreateImage( long entry, idt galID, const wxString&  imgFolder, idt assID )
     }
 }
 
-void ProcessImages( idt galID, const wxString& imgFolder, wxXmlNode* node, idt assID )
+void ProcessImages(
+    idt galID, const wxString& imgFolder, wxXmlReader& reader, idt assID, ReferenceWriter& writer )
 {
-    for ( node = node->GetChildren(); node; node = node->GetNext() ) {
-        if ( node->GetName() == "entry" ) {
-            wxString numStr = xmlGetAllContent( node );
+    int depth = reader.GetDepth();
+    while ( reader.NextChild( depth ) ) {
+        if ( reader.GetAtom() == wxXML_ATOM_ENTRY ) {
+            wxString numStr = reader.ReadElementText();
             long entry;
             if ( numStr.ToLong( &entry) && entry > 0  ) {
-                CreateImage( entry, galID, imgFolder, assID );
+                CreateImage( entry, galID, imgFolder, assID, writer );
             }
         }
     }
 }
 
-void CreateGallery( const wxString& imgFolder, wxXmlNode* node, idt assID )
+void CreateGallery( const wxString& imgFolder, wxXmlReader& reader, idt assID, ReferenceWriter& writer )
 {
     long num = 0;
     wxString title;
@@ -234,26 +224,28 @@ void CreateGallery( const wxString& imgFolder, wxXmlNode* node, idt assID )
     recGallery gal(0);
     gal.CreateUidChanged();
 
-    for ( node = node->GetChildren(); node; node = node->GetNext() ) {
-        if ( node->GetName() == "number" ) {
-            wxString numStr = xmlGetAllContent( node );
+    int depth = reader.GetDepth();
+    while ( reader.NextChild( depth ) ) {
+        if ( reader.GetAtom() == wxXML_ATOM_NUMBER ) {
+            wxString numStr = reader.ReadElementText();
             if ( !numStr.ToLong( &number ) ) return;
             gal.FSetID( number );
-        } else if ( node->GetName() == "title" ) {
-            gal.FSetTitle( xmlGetAllContent( node ) );
-        } else if ( node->GetName() == "entries" ) {
+        } else if ( reader.GetAtom() == wxXML_ATOM_TITLE ) {
+            gal.FSetTitle( reader.ReadElementText() );
+        } else if ( reader.GetAtom() == wxXML_ATOM_ENTRIES ) {
             gal.Save();
-            ProcessImages( gal.FGetID(), imgFolder, node, assID );
+            ProcessImages( gal.FGetID(), imgFolder, reader, assID, writer );
             gal.Clear();
         }
     }
 }
 
-void ProcessGalleries( const wxString& imgFolder, wxXmlNode* node, idt assID )
+void ProcessGalleries( const wxString& imgFolder, wxXmlReader& reader, idt assID, ReferenceWriter& writer )
 {
-    for ( node = node->GetChildren(); node; node = node->GetNext() ) {
-        if ( node->GetName() == "gallery" ) {
-            CreateGallery( imgFolder, node, assID );
+    int depth = reader.GetDepth();
+    while ( reader.NextChild( depth ) ) {
+        if ( reader.GetAtom() == wxXML_ATOM_GALLERY ) {
+            CreateGallery( imgFolder, reader, assID, writer );
         }
     }
 }
@@ -262,13 +254,15 @@ bool InputMediaFiles( const wxString& imgFolder, idt assID )
 {
     wxString filename = imgFolder + "/galspec.xml";
     wxFileName galfn( filename );
-    wxXmlDocument galspec( galfn.GetFullPath() );
-    wxXmlNode* node = galspec.GetRoot();
-    assert( node != nullptr );
+    // The spec is read as it is parsed, no document tree is needed.
+    wxXmlReader galspec;
+    bool ok = galspec.Open( galfn.GetFullPath() ) && galspec.NextChild( 0 );
+    assert( ok );
 
-    for ( node = node->GetChildren(); node; node = node->GetNext() ) {
-        if ( node->GetName() == "galleries" ) {
-            ProcessGalleries( imgFolder, node, assID );
+    ReferenceWriter writer;
+    while ( galspec.NextChild( 1 ) ) {
+        if ( galspec.GetAtom() == wxXML_ATOM_GALLERIES ) {
+            ProcessGalleries( imgFolder, galspec, assID, writer );
         }
     }
     return true;
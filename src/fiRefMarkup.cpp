@@ -46,12 +46,12 @@
 //##===================[ Process RD files with markup ]====================##
 //###########################################################################
 
-void ProcessMarkupRef( idt refID, wxXmlNode* root )
+void ProcessMarkupRef( idt refID, wxXmlNode* root, ReferenceWriter& writer )
 {
     const wxString savepoint = recDb::GetSavepointStr();
     recDb::Savepoint( savepoint );
 
-    fiRefMarkup markup( refID, root );
+    fiRefMarkup markup( refID, root, writer );
     bool ok = markup.create_records();
     if( ok ) {
         recDb::ReleaseSavepoint( savepoint );
@@ -237,7 +237,7 @@ bool fiRefMarkup::create_records()
     wxXmlNode* child = m_root->GetChildren();
     while( child ) {
         if( child->GetType() == wxXML_ELEMENT_NODE &&
-            child->GetName() == "body" )
+            child->GetAtom() == wxXML_ATOM_BODY )
         {
             body = child;
         }
@@ -493,31 +493,21 @@ idt fiRefMarkup::find_id( const wxString& recStr ) const
 
 void fiRefMarkup::markup_node( wxXmlNode* refNode )
 {
-    wxXmlNode* child = refNode->GetChildren();
-    while( child ) {
-        if( child->GetType() == wxXML_ELEMENT_NODE ) {
-            wxString hrefStr;
-            if( child->GetName() == "a" || child->GetName() == "span" ) {
-                wxString rIdStr = child->GetAttribute( "id" );
-                if( rIdStr.size() ) {
-                    hrefStr = convert_local_id( rIdStr );
-                    if( hrefStr.size() ) {
-                        child->SetName( "a" );
-                        // Remove existing attributes.
-                        wxXmlAttribute *a, *a2;
-                        for( a = child->GetAttributes() ; a ; a = a2 ) {
-                            a2 = a->GetNext();
-                            delete a;
-                        }
-                        wxXmlAttribute* a_href = new wxXmlAttribute( "href", hrefStr );
-                        child->SetAttributes( a_href );
-                    }
+    xmlLinkEdits edits;
+    wxXmlWalk( refNode->GetChildren(), [&]( wxXmlNode* node, wxXmlWalkOrder ) {
+        if( node->GetAtom() == wxXML_ATOM_A || node->GetAtom() == wxXML_ATOM_SPAN ) {
+            wxString rIdStr = node->GetAttribute( wxXML_ATOM_ID );
+            if( rIdStr.size() ) {
+                wxString hrefStr = convert_local_id( rIdStr );
+                if( hrefStr.size() ) {
+                    // Replace existing attributes.
+                    edits.replace( node, hrefStr );
                 }
             }
-            markup_node( child );
         }
-        child = child->GetNext();
-    }
+        return wxXML_WALK_CONTINUE;
+    } );
+    edits.apply();
 }
 
 wxString fiRefMarkup::convert_local_id( const wxString& localStr ) const
@@ -725,13 +715,13 @@ void fiRefMarkup::create_reference_rec()
     wxString title;
 
     while( child ) {
-        if( child->GetName() == "body" ) {
+        if( child->GetAtom() == wxXML_ATOM_BODY ) {
             child = child->GetChildren();
             continue;
-        } else if( child->GetName() == "h1" ) {
+        } else if( child->GetAtom() == wxXML_ATOM_H1 ) {
             title = xmlGetAllContent( child );
-        } else if( child->GetName() == "div" ) {
-            wxString idAttr = child->GetAttribute( "id" );
+        } else if( child->GetAtom() == wxXML_ATOM_DIV ) {
+            wxString idAttr = child->GetAttribute( wxXML_ATOM_ID );
             if( idAttr != "topmenu" && refNode == NULL ) {
                 // We should be looking at reference text
                 refNode = child;
@@ -742,16 +732,14 @@ void fiRefMarkup::create_reference_rec()
     }
     if( refNode ) {
         markup_node( refNode );
-        wxString refStr = "<!-- HTML -->\n" + xmlGetSource( refNode );
         recReference ref(0);
         ref.FSetID( m_referenceID );
         ref.FSetHigherID( 0 );
         ref.FSetTitle( title );
-        ref.FSetStatement( refStr );
         ref.FSetResID( 1 );
         ref.FSetUserRef( recReference::GetIdStr( m_referenceID ) );
         ref.CreateUidChanged();
-        ref.Save();
+        m_writer.save( ref, refNode );
     }
 }
 
@@ -31,14 +31,15 @@
 #include <map>
 
 class wxXmlNode;
+class ReferenceWriter;
 
 typedef std::map< const wxString, idt > StringIdMap;
 
 class fiRefMarkup
 {
 public:
-    fiRefMarkup( idt refID, wxXmlNode* root ) 
-        : m_referenceID(refID), m_root(root),
+    fiRefMarkup( idt refID, wxXmlNode* root, ReferenceWriter& writer )
+        : m_referenceID(refID), m_root(root), m_writer(writer),
         m_cur_persona(0), m_cur_date(0), m_cur_place(0), m_cur_eventa(0) {}
 
     bool create_records();
@@ -66,6 +67,7 @@ private:
 
     wxXmlNode*  m_root;
     StringIdMap m_localIDs;
+    ReferenceWriter& m_writer;
 
     idt  m_referenceID;
     idt  m_cur_persona;
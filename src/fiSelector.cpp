@@ -0,0 +1,133 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Name:        fiSelector.cpp
+ * Project:     tfp_fill: Private utility to create Matthews TFP database
+ * Purpose:     fiSelector Class implimentation.
+ * Author:      Nick Matthews
+ * Website:     http://thefamilypack.org
+ * Created:     18th October 2026
+ * Copyright:   Copyright (c) 2026, Nick Matthews.
+ * Licence:     GNU GPLv3
+ *
+ *  tfp_fill is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tfp_fill is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tfp_fill.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+*/
+
+#include "wx/wxprec.h"
+
+#ifdef __BORLANDC__
+    #pragma hdrstop
+#endif
+
+#ifndef WX_PRECOMP
+#include "wx/wx.h"
+#endif
+
+#include "fiSelector.h"
+
+#include "nkMain.h"
+
+void fiSelector::compile( const wxString& path )
+{
+    m_steps.clear();
+    wxString::const_iterator it = path.begin();
+    wxString::const_iterator end = path.end();
+    bool sibling = false;
+    for(;;) {
+        Step step;
+        step.sibling = sibling;
+        step.index = -1;
+        step.has_text = false;
+        if( it != end && *it == '*' ) {
+            ++it;
+        } else {
+            while( it != end && ( wxIsalnum( *it ) || *it == '_' || *it == '-' ) ) {
+                step.name += *it++;
+            }
+            if( step.name.empty() ) break;
+        }
+        step.atom = wxXmlGetAtom( step.name );
+        if( it != end && *it == '[' ) {
+            int index = 0;
+            for( ++it ; it != end && wxIsdigit( *it ) ; ++it ) {
+                index = index * 10 + ( wxUniChar( *it ).GetValue() - '0' );
+            }
+            if( it == end || *it != ']' ) break;
+            ++it;
+            step.index = index;
+        }
+        if( it != end && *it == ':' ) {
+            static const wxString textFn = ":text(\"";
+            if( path.compare( it - path.begin(), textFn.length(), textFn ) != 0 ) break;
+            it += textFn.length();
+            while( it != end && *it != '"' ) {
+                step.text += *it++;
+            }
+            if( it == end || ++it == end || *it != ')' ) break;
+            ++it;
+            step.has_text = true;
+        }
+        m_steps.push_back( step );
+        if( it == end ) {
+            return;
+        }
+        if( *it != '/' && *it != '+' ) break;
+        sibling = ( *it++ == '+' );
+    }
+    wxASSERT_MSG( false, "Bad selector: " + path );
+    m_steps.clear();
+}
+
+bool fiSelector::matches( const Step& step, wxXmlNode* node ) const
+{
+    if( node->GetType() != wxXML_ELEMENT_NODE ) {
+        return false;
+    }
+    if( step.atom != wxXML_ATOM_UNKNOWN ) {
+        return node->GetAtom() == step.atom;
+    }
+    return step.name.empty() || node->GetName() == step.name;
+}
+
+wxXmlNode* fiSelector::run( wxXmlNode* node, size_t s ) const
+{
+    const Step& step = m_steps[s];
+    int count = 0;
+    for( node = step.sibling ? node->GetNext() : node->GetChildren() ; node ; node = node->GetNext() ) {
+        if( !matches( step, node ) ) continue;
+        if( step.index >= 0 && count++ != step.index ) continue;
+        if( !step.has_text || xmlGetCachedContent( node ) == step.text ) {
+            if( s + 1 == m_steps.size() ) {
+                return node;
+            }
+            wxXmlNode* found = run( node, s + 1 );
+            if( found ) {
+                return found;
+            }
+        }
+        if( step.index >= 0 ) break;
+    }
+    return nullptr;
+}
+
+wxXmlNode* fiSelector::find( wxXmlNode* context ) const
+{
+    if( !context || m_steps.empty() ) {
+        return nullptr;
+    }
+    return run( context, 0 );
+}
+
+// End of fiSelector.cpp file
@@ -0,0 +1,77 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Name:        fiSelector.h
+ * Project:     tfp_fill: Private utility to create Matthews TFP database
+ * Purpose:     fiSelector Class header, compiled element paths.
+ * Author:      Nick Matthews
+ * Created:     18th October 2026
+ * Copyright:   Copyright (c) 2026, Nick Matthews.
+ * Licence:     GNU GPLv3
+ *
+ *  tfp_fill is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tfp_fill is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tfp_fill.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+*/
+
+#ifndef FILL_FISELECTOR_H
+#define FILL_FISELECTOR_H
+
+#include "xml2.h"
+
+#include <vector>
+
+// A path through the element tree, such as
+//
+//     table[0]/tr[3]/td[5]
+//     tr/td:text("Source:")+td
+//
+// Each step names an element, or * for any element. "/" steps down to the
+// children of the current element, "+" steps on to its following siblings.
+// [n] picks the n'th (from 0) element matching the name, without it all
+// matching elements are tried in turn. :text("str") only accepts an element
+// whose xmlGetAllContent() is str. The first match in document order is
+// returned.
+//
+// The path is compiled once, when constructed, so selectors are best held
+// as statics, one set for each document layout that is read.
+class fiSelector
+{
+public:
+    fiSelector( const char* path ) { compile( wxString::FromUTF8( path ) ); }
+    fiSelector( const wxString& path ) { compile( path ); }
+
+    bool is_ok() const { return !m_steps.empty(); }
+
+    // Returns the first element matching the path, starting from the
+    // children of context, or nullptr.
+    wxXmlNode* find( wxXmlNode* context ) const;
+
+private:
+    struct Step {
+        bool      sibling;  // "+" rather than "/".
+        wxXmlAtom atom;     // Or wxXML_ATOM_UNKNOWN, when name is used.
+        wxString  name;     // Empty for "*".
+        int       index;    // -1 when any match will do.
+        bool      has_text;
+        wxString  text;
+    };
+
+    void compile( const wxString& path );
+    bool matches( const Step& step, wxXmlNode* node ) const;
+    wxXmlNode* run( wxXmlNode* node, size_t s ) const;
+
+    std::vector<Step> m_steps;
+};
+
+#endif // FILL_FISELECTOR_H
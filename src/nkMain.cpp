@@ -77,6 +77,7 @@ const wxString g_title = PROGNAME " - Version " VERSION VERSION_CONFIG "\n"
 
 bool g_verbose = false;
 bool g_quiet   = false;
+bool g_minify  = false;
 
 /*#*************************************************************************
  **  main
@@ -90,6 +91,7 @@ int main( int argc, char** argv )
             wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
         { wxCMD_LINE_SWITCH, "v", "verbose", "be verbose" },
         { wxCMD_LINE_SWITCH, "q", "quiet",   "be quiet" },
+        { wxCMD_LINE_SWITCH, "b", "bench",   "time loading the reference documents and exit" },
         { wxCMD_LINE_PARAM,  NULL, NULL, "command-file",
             wxCMD_LINE_VAL_STRING, wxCMD_LINE_OPTION_MANDATORY },
         { wxCMD_LINE_NONE }
@@ -139,6 +141,11 @@ int main( int argc, char** argv )
     wxString outPhotoFile = conf.Read( "/Output/Family-Photos" );
     wxString outCensusFile = conf.Read( "/Output/Census-Scans" );
     wxString outBMDFile = conf.Read( "/Output/BMD-Scans" );
+    wxString xmlParser = conf.Read( "/Input/Xml-Parser", "expat" );
+    if( xmlParser == "native" ) {
+        wxXmlDocument::SetParser( wxXML_PARSER_NATIVE );
+    }
+    conf.Read( "/Output/Minify-Statements", &g_minify, false );
 
     wxPrintf( "Database version: %s\n", recFullVersion );
     wxPrintf( "SQLite3 version: %s\n", wxSQLite3Database::GetVersion() );
@@ -153,6 +160,14 @@ int main( int argc, char** argv )
     wxPrintf( "Family photos database file: [%s]\n", outPhotoFile );
     wxPrintf( "Media database file: [%s]\n", outCensusFile );
     wxPrintf( "Media database file: [%s]\n", outBMDFile );
+    wxPrintf( "Xml parser: [%s]\n", xmlParser );
+    wxPrintf( "Minify statements: [%s]\n", g_minify ? "yes" : "no" );
+
+    if( parser.Found( "b" ) ) {
+        BenchmarkXmlLoad( refFolder );
+        recUninitialize();
+        return EXIT_SUCCESS;
+    }
 
     if( wxFileExists( outFile ) ) {
         wxRemoveFile( outFile );
@@ -233,40 +248,116 @@ int main( int argc, char** argv )
     return ret;
 }
 
-recEntity DecodeOldHref( const wxString & href )
+namespace {
+
+// The entity letters used by tfp links, longest first where they share a
+// first letter.
+struct HrefPrefix {
+    const char* letters;
+    recEntity   entity;
+};
+const HrefPrefix s_hrefPrefixes[] = {
+    { "Pa", recENT_Persona },
+    { "Ea", recENT_Eventa },
+    { "Ci", recENT_Citation },
+    { "I",  recENT_Individual },
+    { "F",  recENT_Family },
+    { "E",  recENT_Event },
+    { "D",  recENT_Date },
+    { "P",  recENT_Place },
+    { "N",  recENT_Name },
+    { "R",  recENT_Reference },
+    { "M",  recENT_Media },
+    { "G",  recENT_Gallery }
+};
+
+// Works on wxString iterators or char pointers alike, without copying.
+inline unsigned HrefCode( char ch ) { return (unsigned char) ch; }
+inline unsigned HrefCode( const wxUniChar& ch ) { return ch.GetValue(); }
+
+template<class It>
+bool MatchHref( It& it, It end, const char* str )
 {
-    recEntity ent = recENT_NULL;
-    wxString start = href.Mid( 0, 5 );
-    if ( start == "../ps" ) {
-        ent = recENT_Individual;
-    } else if ( start == "../wc" ) {
-        ent = recENT_Family;
+    It p = it;
+    for( ; *str ; ++str, ++p ) {
+        if( p == end || HrefCode( *p ) != (unsigned char) *str ) return false;
     }
-    return ent;
+    it = p;
+    return true;
 }
 
-bool DecodeHref( const wxString& href, idt* indID, wxString* indIdStr )
+// Up to 9 digits are read, so the number always fits a long.
+template<class It>
+bool ReadHrefNumber( It& it, It end, long* number )
 {
-    long dir, fnum, id; 
-    // Old Individual href format = "../ps01/ps01_016.htm"
-    // TFP format is "tfp:I16"
-    if( href.Mid( 0, 4 ) == "tfp:" ) { 
-        // Already converted.
-        if( !href.Mid( 5 ).ToLong( &id ) ) return false;
-    } else {
-        if( href.Mid( 0, 5 ) != "../ps" ) return false;
-        if( !href.Mid( 5, 2 ).ToLong( &dir ) ) return false;
-        if( !href.Mid( 13, 3 ).ToLong( &fnum ) ) return false;
-        id = (dir-1)*500 + fnum;
-        if( id < 1 ) return false;
-    }
-    *indID = id;
-    if( indIdStr ) {
-        *indIdStr = wxString::Format( "tfp:I%ld", id );
+    const int maxDigits = 9;
+    bool negative = MatchHref( it, end, "-" );
+    long num = 0;
+    int digits = 0;
+    for( ; it != end && HrefCode( *it ) - '0' <= 9 ; ++it ) {
+        if( ++digits > maxDigits ) return false;
+        num = num * 10 + ( HrefCode( *it ) - '0' );
     }
+    if( digits == 0 ) return false;
+    *number = negative ? -num : num;
     return true;
 }
 
+template<class It>
+bool DoParseHref( It it, It end, HrefLink* link )
+{
+    long dir, fnum, id;
+    // Old format "../ps01/ps01_016.htm" or "../wc01/wc01_002.htm"
+    if( MatchHref( it, end, "../" ) ) {
+        const char* dirName;
+        if( MatchHref( it, end, "ps" ) ) {
+            link->entity = recENT_Individual;
+            dirName = "/ps";
+        } else if( MatchHref( it, end, "wc" ) ) {
+            link->entity = recENT_Family;
+            dirName = "/wc";
+        } else {
+            return false;
+        }
+        if( !ReadHrefNumber( it, end, &dir ) || dir < 1 ) return false;
+        if( !MatchHref( it, end, dirName ) || !ReadHrefNumber( it, end, &fnum ) ) return false;
+        if( !MatchHref( it, end, "_" ) || !ReadHrefNumber( it, end, &fnum ) ) return false;
+        // Anything after the file name, such as a fragment, is not read.
+        if( !MatchHref( it, end, ".htm" ) ) return false;
+        link->id = ( dir - 1 ) * 500 + fnum;
+        link->old = true;
+        return true;
+    }
+    // TFP formats "tfp:I16", "tfpi:P12" and "tfpr:Pa7"
+    if( !MatchHref( it, end, "tfp" ) ) return false;
+    if( !MatchHref( it, end, ":" ) && !MatchHref( it, end, "i:" ) && !MatchHref( it, end, "r:" ) ) {
+        return false;
+    }
+    for( size_t i = 0 ; i < WXSIZEOF( s_hrefPrefixes ) ; i++ ) {
+        It p = it;
+        if( MatchHref( p, end, s_hrefPrefixes[i].letters ) && ReadHrefNumber( p, end, &id ) && p == end ) {
+            link->entity = s_hrefPrefixes[i].entity;
+            link->id = id;
+            link->old = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+bool ParseHref( const wxString& href, HrefLink* link, size_t pos )
+{
+    if( pos > href.length() ) return false;
+    return DoParseHref( href.begin() + pos, href.end(), link );
+}
+
+bool ParseHref( const char* href, size_t len, HrefLink* link )
+{
+    return DoParseHref( href, href + len, link );
+}
+
 wxString CreateCommaList( wxString& first, wxString& second )
 {
     first.Trim();
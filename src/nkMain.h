@@ -32,6 +32,10 @@
 
 #include <rec/recDb.h>
 
+#include "xml2.h"
+
+#include <unordered_map>
+
 enum recEntity {
     recENT_NULL,
     recENT_Individual,
@@ -51,6 +55,7 @@ enum recEntity {
 };
 
 class wxXmlNode;
+class ReferenceWriter;
 typedef std::vector< wxFileName > Filenames;
 
 struct Media {
@@ -63,14 +68,31 @@ typedef std::vector< Media > MediaVec;
 using AssFileMap = std::map<wxString, idt>;
 
 
+// A link found in an href attribute, see ParseHref().
+struct HrefLink {
+    recEntity entity;
+    idt       id;
+    bool      old;    // From a ../psNN or ../wcNN file name.
+};
+
 /* nkMain.cpp */
-extern recEntity DecodeOldHref( const wxString& href );
-extern bool DecodeHref( const wxString& href, idt* indID, wxString* indIdStr );
+extern bool g_verbose;
+// Set from "/Output/Minify-Statements", reference statements are passed
+// through xmlMinify() before they are stored.
+extern bool g_minify;
+// Reads any of the link forms, "../ps01/ps01_016.htm", "../wc01/wc01_002.htm",
+// "tfp:I16", "tfpi:P12" or "tfpr:Pa7", straight from the characters. A tfp
+// link must end the string, an old one may be followed by anything.
+extern bool ParseHref( const wxString& href, HrefLink* link, size_t pos = 0 );
+extern bool ParseHref( const char* href, size_t len, HrefLink* link );
 extern wxString CreateCommaList( wxString& first, wxString& second );
 extern bool CreateMediaFile(
     AssFileMap& assMap, const wxString& name, const wxString& dbfile, const wxString& comment );
 extern void ScanIndividuals();
 
+/* fiBench.cpp */
+extern void BenchmarkXmlLoad( const wxString& refFolder );
+
 /* fiCommon.cpp */
 
 /* fiMedia.cpp */
@@ -79,7 +101,7 @@ extern bool OutputMediaDatabase(
     const wxString& refFolder, const MediaVec& media, AssFileMap& assMap );
 
 /* fiRefMarkup.cpp */
-extern void ProcessMarkupRef( idt refID, wxXmlNode* root );
+extern void ProcessMarkupRef( idt refID, wxXmlNode* root, ReferenceWriter& writer );
 
 /* nkRefDocuments.cpp */
 extern bool InputRefFiles( const wxString& refFolder, MediaVec& media );
@@ -90,6 +112,31 @@ extern void ProcessCustomFile( wxFileName& fn, MediaVec& media );
 /* nkRecHelpers.cpp */
 extern bool ExportGedcom( const wxString& path );
 
+// Writes Reference records whose statement is UTF-8 text. The statement is
+// bound as it is, it is not widened to a wxString and converted back. The
+// SQL statements are prepared on first use and finalized with the writer,
+// so a writer is created for one input run while the database is open.
+class ReferenceWriter
+{
+public:
+    // Inserts ref with the given statement, replacing any record with the
+    // same id. If ref has no id, it is given the new one. The statement
+    // held by ref is not used or changed.
+    bool save( recReference& ref, const std::string& statement );
+    // As above, the statement being the markup of node after the
+    // "<!-- HTML -->" marker. With g_minify set, node's tree is minified
+    // in place first.
+    bool save( recReference& ref, wxXmlNode* node );
+    // Replaces the statement of a saved record, for statements that can
+    // only be written once the record has its id.
+    bool update( idt refID, const std::string& statement );
+
+private:
+    wxSQLite3Statement m_insert;
+    wxSQLite3Statement m_update;
+    std::string        m_statement; // Grows to fit the largest statement.
+};
+
 extern void UpdateOccupationEvents();
 extern idt CreateDate( const wxString& date, idt refID, int* pseq = nullptr );
 extern idt CreateDateFromAge( long age, idt baseID, idt refID, int* pseq = nullptr );
@@ -130,23 +177,141 @@ extern wxString ProperCase( const wxString& str );
 /* nkXmlHelpers.cpp */
 class wxXmlNode;
 extern wxString xmlGetSource( wxXmlNode* node );
+// The same markup, appended to out as UTF-8.
+extern void xmlAppendSource( wxXmlNode* node, std::string& out );
+// Drops comments, other than "<!-- HTML -->", and collapses whitespace
+// that does not change how the markup is rendered. The content of <pre>,
+// <textarea>, <script> and <style> is left as it is.
+extern void xmlMinify( wxXmlNode* node );
 extern wxString xmlGetAllContent( wxXmlNode* node );
+// The same text, kept on the node until its subtree is edited, for cells
+// that are read more than once. The reference must not be held over an
+// edit.
+extern const wxString& xmlGetCachedContent( wxXmlNode* node );
+// Appends the text to str, so a caller can reuse one buffer.
+extern void xmlAppendAllContent( wxXmlNode* node, wxString& str );
 extern wxXmlNode* xmlGetFirstText( wxXmlNode* node );
 extern wxXmlNode* xmlGetFirst( wxXmlNode* node, const wxString& tag );
 extern wxXmlNode* xmlGetNext( wxXmlNode* node, const wxString& tag );
 extern wxXmlNode* xmlGetChild( wxXmlNode* node );
 extern wxXmlNode* xmlGetFirstChild( wxXmlNode* node, const wxString& tag );
+extern wxXmlNode* xmlGetFirst( wxXmlNode* node, wxXmlAtom tag );
+extern wxXmlNode* xmlGetNext( wxXmlNode* node, wxXmlAtom tag );
+extern wxXmlNode* xmlGetFirstChild( wxXmlNode* node, wxXmlAtom tag );
 extern wxXmlNode* xmlGetFirstTag( wxXmlNode* node, const wxString& tag );
 extern wxXmlNode* xmlGetNextTag( wxXmlNode* node, const wxString& tag );
-extern idt GetIndividualAnchor( wxXmlNode* node, wxString* name, wxXmlNode** aNode );
+
+// Index of a <table> element, built in one pass over its <tr> children.
+// Only the table's own rows and cells are indexed, so nested tables and
+// text nodes are ignored. Lookups outside the table return nullptr, as
+// a chain of xmlGetNext() calls would.
+class xmlTableView
+{
+public:
+    xmlTableView( wxXmlNode* table = nullptr ) { build( table ); }
+
+    void build( wxXmlNode* table );
+
+    wxXmlNode* table() const { return m_table; }
+    size_t row_count() const { return m_rows.size(); }
+    size_t col_count() const { return m_cols; }
+    wxXmlNode* row( size_t r ) const { return r < m_rows.size() ? m_rows[r] : nullptr; }
+    // The number of <td> elements in row r.
+    size_t item_count( size_t r ) const
+        { return r < m_rows.size() ? m_itemStart[r+1] - m_itemStart[r] : 0; }
+    // The n'th <td> element of row r, counting elements not columns.
+    wxXmlNode* item( size_t r, size_t n ) const;
+    // The <td> or <th> element covering column col of row r, allowing for
+    // colspan and rowspan.
+    wxXmlNode* cell( size_t r, size_t col ) const;
+
+private:
+    wxXmlNode*              m_table;
+    std::vector<wxXmlNode*> m_rows;
+    std::vector<size_t>     m_itemStart; // Index into m_items for each row, plus end.
+    std::vector<wxXmlNode*> m_items;
+    std::vector<wxXmlNode*> m_grid;      // row_count() * col_count() cells.
+    size_t                  m_cols;
+};
+
+// The <a href> elements listed by a document loaded with
+// wxXMLDOC_INDEX_ANCHORS, each href decoded once. The entries describe the
+// links as loaded, they are not updated when a link is changed.
+struct xmlAnchor {
+    wxXmlNode* node;
+    recEntity  entity; // As read by ParseHref(), or recENT_NULL.
+    idt        id;     // Of the entity, else 0.
+    bool       old;    // From a ../psNN or ../wcNN file name.
+};
+
+class xmlAnchorIndex
+{
+public:
+    xmlAnchorIndex( const wxXmlDocument& doc ) { build( doc ); }
+
+    void build( const wxXmlDocument& doc );
+
+    size_t size() const { return m_anchors.size(); }
+    const xmlAnchor& operator[]( size_t i ) const { return m_anchors[i]; }
+    // The anchors inside region are the entries [*begin, *end).
+    void range( wxXmlNode* region, size_t* begin, size_t* end ) const;
+    // The same for node together with the siblings that follow it.
+    void range_from( wxXmlNode* node, size_t* begin, size_t* end ) const;
+    // The entry for the <a> element node, or nullptr.
+    const xmlAnchor* find( wxXmlNode* node ) const;
+
+private:
+    typedef std::pair<size_t, size_t> Range;
+
+    std::vector<xmlAnchor>                 m_anchors;
+    std::unordered_map<wxXmlNode*, size_t> m_nodes;   // Element to its entry.
+    std::unordered_map<wxXmlNode*, Range>  m_regions; // Element to its anchors.
+};
+
+extern idt GetIndividualAnchor(
+    const xmlAnchorIndex& anchors, wxXmlNode* cell, wxString* name, wxXmlNode** aNode );
+
+// Link changes recorded while a document is read, then made in one pass by
+// apply() before it is saved. The recorded node and text positions are those
+// of the document as read. The hrefs are written into one shared buffer.
+class xmlLinkEdits
+{
+public:
+    // Puts all the children of element node inside a new link.
+    void create( wxXmlNode* node, const wxString& href );
+    void create( wxXmlNode* node, recEntity entity, idt id );
+    // Links the characters beg to end (-1 for all) of the first text
+    // node in node.
+    void create( wxXmlNode* node, int beg, int end, recEntity entity, idt id );
+    // Changes the href of an existing link.
+    void change( wxXmlNode* node, const wxString& href );
+    void change( wxXmlNode* node, recEntity entity, idt id );
+    // Makes node a link with the href as its only attribute.
+    void replace( wxXmlNode* node, const wxString& href );
+
+    // Returns the number of edits dropped because an earlier one covers
+    // the same node or the same characters.
+    size_t apply();
+
+private:
+    enum Kind { EDIT_Range, EDIT_Wrap, EDIT_Change, EDIT_Replace };
+    struct Edit {
+        Kind       kind;
+        wxXmlNode* node;
+        int        beg, end;  // For EDIT_Range.
+        size_t     href, len; // Position in m_hrefs.
+    };
+
+    void split_text( const Edit* first, const Edit* last, size_t* dropped );
+
+    std::vector<Edit> m_edits;
+    wxString          m_hrefs;
+};
 
 extern wxString xmlReadRecLoc( const wxString& str );
 
 extern wxXmlNode* xmlCreateLink( wxXmlNode* node, const wxString& href );
 extern wxXmlNode* xmlCreateLink( wxXmlNode* node, int beg, int end, const wxString& href );
 extern bool xmlChangeLink( wxXmlNode* node, const wxString& href );
-extern wxXmlNode* xmlCreateLink( wxXmlNode* node, recEntity entity, idt id );
-extern wxXmlNode* xmlCreateLink( wxXmlNode* node, int beg, int end, recEntity entity, idt id );
-extern bool xmlChangeLink( wxXmlNode* node, recEntity entity, idt id );
 
 #endif // NKMAIN_H
\ No newline at end of file
@@ -825,4 +825,60 @@ wxString ProperCase( const wxString& str )
     return output;
 }
 
+bool ReferenceWriter::save( recReference& ref, const std::string& statement )
+{
+    // The columns written by recReference::Save(). A null id is given the
+    // next free one by SQLite.
+    if( !m_insert.IsOk() ) {
+        m_insert = recDb::GetDb()->PrepareStatement(
+            "INSERT OR REPLACE INTO Reference"
+            " (id, higher_id, title, statement, res_id, user_ref, uid, changed)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?, ?);"
+        );
+    }
+    m_insert.Reset();
+    if( ref.FGetID() == 0 ) {
+        m_insert.BindNull( 1 );
+    } else {
+        m_insert.Bind( 1, wxLongLong( ref.FGetID() ) );
+    }
+    m_insert.Bind( 2, wxLongLong( ref.FGetHigherID() ) );
+    m_insert.Bind( 3, ref.FGetTitle() );
+    m_insert.Bind( 4, statement.c_str() );
+    m_insert.Bind( 5, wxLongLong( ref.FGetResID() ) );
+    m_insert.Bind( 6, ref.FGetUserRef() );
+    m_insert.Bind( 7, ref.FGetUid() );
+    m_insert.Bind( 8, wxLongLong( ref.FGetChanged() ) );
+    if( m_insert.ExecuteUpdate() != 1 ) {
+        return false;
+    }
+    if( ref.FGetID() == 0 ) {
+        ref.FSetID( recDb::GetDb()->GetLastRowId().GetValue() );
+    }
+    return true;
+}
+
+bool ReferenceWriter::save( recReference& ref, wxXmlNode* node )
+{
+    if( g_minify ) {
+        xmlMinify( node );
+    }
+    m_statement = "<!-- HTML -->\n";
+    xmlAppendSource( node, m_statement );
+    return save( ref, m_statement );
+}
+
+bool ReferenceWriter::update( idt refID, const std::string& statement )
+{
+    if( !m_update.IsOk() ) {
+        m_update = recDb::GetDb()->PrepareStatement(
+            "UPDATE Reference SET statement=? WHERE id=?;"
+        );
+    }
+    m_update.Reset();
+    m_update.Bind( 1, statement.c_str() );
+    m_update.Bind( 2, wxLongLong( refID ) );
+    return m_update.ExecuteUpdate() == 1;
+}
+
 // End of nkRefDocuments.cpp file
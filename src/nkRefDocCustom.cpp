@@ -172,11 +172,11 @@ wxString GetDateStrDay( long year, long month, long day )
 idt GetIdFromHref( const wxString& href )
 {
     // href="../ps01/ps01_459.htm"
-    long dir, file;
-    if( !href.Mid( 11, 2 ).ToLong( &dir ) ) return 0;
-    if( !href.Mid( 19, 3 ).ToLong( &file ) ) return 0;
-    if( dir < 1 ) return 0;
-    return ( dir - 1 ) * 500 + file;
+    static const wxString attr = "href=\"";
+    HrefLink link;
+    if( href.compare( 0, attr.length(), attr ) != 0 ) return 0;
+    if( !ParseHref( href, &link, attr.length() ) || !link.old ) return 0;
+    return link.id;
 }
 
 bool TidyStr( wxString* str )
@@ -40,52 +40,46 @@
 
 #include <rec/recDb.h>
 
+#include "fiSelector.h"
 #include "nkMain.h"
 #include "xml2.h"
 
-void CreateEntityLink( wxXmlNode* node, idt refID, std::map<wxString, idt>& elements )
+#include <unordered_map>
+
+void CreateEntityLink(
+    const xmlAnchor& anchor, xmlLinkEdits& edits, idt refID, std::unordered_map<idt, idt>& elements )
 {
     // TODO: Create entitities other than Persona. 
-    wxString href = node->GetAttribute( "href" );
-    recEntity ent = DecodeOldHref( href );
-    if ( ent != recENT_Individual ) return;
-    long dir, fnum;
-    if ( !href.Mid( 5, 2 ).ToLong( &dir ) ) return;
-    if ( !href.Mid( 13, 3 ).ToLong( &fnum ) ) return;
-    idt id = ( dir - 1 ) * 500 + fnum;
+    if ( !anchor.old || anchor.entity != recENT_Individual || anchor.id < 1 ) return;
+    wxXmlNode* node = anchor.node;
 
     wxString name = xmlGetAllContent( node );
 
-    idt perID = 0;
-    if ( elements.count( href ) > 0 ) {
-        perID = elements[href];
+    idt& perID = elements[anchor.id];
+    if ( perID != 0 ) {
         idt nameID = CreatePerName( name, perID );
         recReferenceEntity::Create( refID, recReferenceEntity::TYPE_Name, nameID );
     } else {
-        perID = CreatePersona( refID, id, name );
-        elements[href] = perID;
+        perID = CreatePersona( refID, anchor.id, name );
     }
 
-    xmlChangeLink( node, recENT_Persona, perID );
+    edits.change( node, recENT_Persona, perID );
 }
 
-void CreateElements( wxXmlNode* node, idt  refID, std::map<wxString, idt>& elements )
+void CreateElements( wxXmlNode* node, const xmlAnchorIndex& anchors, xmlLinkEdits& edits,
+    idt refID, std::unordered_map<idt, idt>& elements )
 {
-    do {
-        if ( node->GetChildren() ) {
-            CreateElements( node->GetChildren(), refID, elements );
-        }
-        if ( node->GetType() == wxXML_ELEMENT_NODE && node->GetName() == "a" ) {
-            CreateEntityLink( node, refID, elements );
-        }
-        node = node->GetNext();
-    } while ( node );
+    size_t i, end;
+    for( anchors.range_from( node, &i, &end ) ; i < end ; i++ ) {
+        CreateEntityLink( anchors[i], edits, refID, elements );
+    }
 }
 
-void DoCreateElements( wxXmlNode* node, idt  refID )
+void DoCreateElements(
+    wxXmlNode* node, const xmlAnchorIndex& anchors, xmlLinkEdits& edits, idt refID )
 {
-    std::map<wxString, idt> elements;
-    CreateElements( node, refID, elements );
+    std::unordered_map<idt, idt> elements; // Individual to persona.
+    CreateElements( node, anchors, edits, refID, elements );
 }
 
 idt g_researcherID = 1;
@@ -112,47 +106,28 @@ void CreateSourceGlobals()
 {
 }
 
-void ListIndividuals( wxXmlNode* node, recIdVec& list, wxArrayString& names )
+void ListIndividuals( wxXmlNode* node, const xmlAnchorIndex& anchors, xmlLinkEdits& edits,
+    recIdVec& list, wxArrayString& names )
 {
-    while( node ) {
-        if( node->GetType() == wxXML_ELEMENT_NODE ) {
-            if( node->GetName() == "a" ) {
-                wxXmlAttribute* attr = node->GetAttributes();
-                idt indID = 0;
-                wxString name, title;
-                while ( attr ) {
-                    if ( attr->GetName() == "href" ) {
-                        wxString newHref;
-                        idt id;
-                        if ( DecodeHref( attr->GetValue(), &id, &newHref ) ) {
-                            attr->SetValue( newHref );
-                            indID = id;
-                            name = xmlGetAllContent( node );
-                        }
-                    } else if ( attr->GetName() == "title" ) {
-                        title = attr->GetValue();
-                    }
-                    attr = attr->GetNext();
-                }
-                if ( indID > 0 ) {
-                    list.push_back( indID );
-                    if ( title.empty() ) {
-                        names.push_back( name );
-                    } else {
-                        names.push_back( title );
-                    }
-                }
-            } else {
-                ListIndividuals( node->GetChildren(), list, names );
-            }
+    size_t i, end;
+    for( anchors.range_from( node, &i, &end ) ; i < end ; i++ ) {
+        const xmlAnchor& a = anchors[i];
+        if ( a.entity != recENT_Individual || a.id < 1 ) continue;
+        edits.change( a.node, wxString::Format( "tfp:I" ID, a.id ) );
+        list.push_back( a.id );
+        wxString title = a.node->GetAttribute( wxXML_ATOM_TITLE );
+        if ( title.empty() ) {
+            names.push_back( xmlGetAllContent( a.node ) );
+        } else {
+            names.push_back( title );
         }
-       node = node->GetNext();
     }
 }
 
 // Create date from a node holding an age value and
 // place a anchor link around it pointing to the new date record.
-idt CreateDateFromAge( wxXmlNode* node, idt baseID, idt refID, int* pseq = nullptr )
+idt CreateDateFromAge(
+    wxXmlNode* node, xmlLinkEdits& edits, idt baseID, idt refID, int* pseq = nullptr )
 {
     long age;
     wxString ageStr = xmlGetAllContent( node );
@@ -161,14 +136,14 @@ idt CreateDateFromAge( wxXmlNode* node, idt baseID, idt refID, int* pseq = nullp
     }
     idt dateID = CreateDateFromAge( age, baseID, refID, pseq );
 
-    xmlCreateLink( node, recENT_Date, dateID );
+    edits.create( node, recENT_Date, dateID );
 
     return dateID;
 }
 
 // Create place record from a node holding an address value and
 // place a anchor link around it pointing to the new place record.
-idt CreatePlace( wxXmlNode* node, idt refID, int* pseq = nullptr)
+idt CreatePlace( wxXmlNode* node, xmlLinkEdits& edits, idt refID, int* pseq = nullptr)
 {
     wxString address = xmlGetAllContent( node );
     if( address.IsEmpty() ) {
@@ -176,61 +151,110 @@ idt CreatePlace( wxXmlNode* node, idt refID, int* pseq = nullptr)
     }
     idt placeID = CreatePlace( address, refID, pseq );
 
-    xmlCreateLink( node, recENT_Place, placeID );
+    edits.create( node, recENT_Place, placeID );
 
     return placeID;
 }
 
-wxString GetCensusAddress( wxXmlNode* table, wxXmlNode** link )
+// A cell of an xmlTableView.
+struct TableCell {
+    size_t row;
+    size_t col;
+};
+
+// Where the address fields are found in the first table of a census.
+struct CensusAddressLayout {
+    fiSelector match;   // Accepts a table with this layout.
+    TableCell address;  // "Address"
+    TableCell parish;   // "Civil Parish"
+    TableCell county;   // "Administrative County"
+};
+
+// The shape of a table: its row count and the number of items in each
+// of its first rows, hashed. Only the rows the layouts read are looked at
+// and no text is read, so it costs the same for every table. Tables with
+// the same fingerprint are taken to have the same layout.
+unsigned long long GetTableFingerprint( const xmlTableView& table )
+{
+    const size_t maxRows = 8;
+    size_t rows = table.row_count();
+    if( rows > maxRows ) {
+        rows = maxRows;
+    }
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    auto add = [&hash]( unsigned long long value ) {
+        hash = ( hash ^ value ) * 1099511628211ULL;
+    };
+    add( rows );
+    for( size_t row = 0 ; row < rows ; row++ ) {
+        add( table.item_count( row ) );
+    }
+    return hash;
+}
+
+// Finds the layout for the first table of a census. The first time a
+// table shape is seen, each layout's match selector is tried in turn and
+// the fingerprint is mapped to the one found. After that the layout is a
+// single lookup. The last is the standard layout, which is also used for
+// an empty table. New layouts go in front of it.
+// TODO: Institutions (ie R559) have different layout for address
+const CensusAddressLayout& GetCensusAddressLayout( const xmlTableView& table )
+{
+    static const CensusAddressLayout s_layouts[] = {
+        // 1911 format has extra row
+        {
+            "tr[0]/td[1]:text(\"Signature:\")",
+            { 1, 2 }, { 2, 2 }, { 4, 5 }
+        },
+        // Standard layout, used for 1901.
+        {
+            "tr[0]",
+            { 0, 2 }, { 1, 2 }, { 3, 5 }
+        }
+    };
+    static std::unordered_map<unsigned long long, size_t> s_known;
+
+    unsigned long long print = GetTableFingerprint( table );
+    auto it = s_known.find( print );
+    if( it != s_known.end() ) {
+        return s_layouts[it->second];
+    }
+    size_t layout = WXSIZEOF( s_layouts ) - 1;
+    for( size_t i = 0 ; i < layout ; i++ ) {
+        if( s_layouts[i].match.find( table.table() ) ) {
+            layout = i;
+            break;
+        }
+    }
+    s_known[print] = layout;
+    return s_layouts[layout];
+}
+
+wxString GetCensusAddress( const xmlTableView& table, wxXmlNode** link )
 {
-    wxString address;
-    wxString part;
-    wxXmlNode* row;
-    wxXmlNode* data;
     // Get address, 1901 files have been structured differently from others
     // census. We will make the address by combining the "Address", "Civil
     // Parish" and "Administrative County" fields.
-    // TODO: Institutions (ie R559) have different layout for address
-    row = xmlGetFirstChild( table, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    if( xmlGetAllContent( data ) == "Signature:" ) {
-        row = xmlGetNext( row, "tr" );        // 1911 format has extra row
-        data = xmlGetFirstChild( row, "td" );
-        data = xmlGetNext( data, "td" );
-    }
-    data = xmlGetNext( data, "td" );
-    address = xmlGetAllContent( data ); // "Address"
+    const CensusAddressLayout& layout = GetCensusAddressLayout( table );
+    wxXmlNode* data = table.item( layout.address.row, layout.address.col );
+    wxString address = xmlGetAllContent( data );
     if ( !address.empty() ) {
         *link = data;
     }
-    row = xmlGetNext( row, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    part = xmlGetAllContent( data );   // "Civil Parish"
+    wxString part = xmlGetAllContent( table.item( layout.parish.row, layout.parish.col ) );
     address = CreateCommaList( address, part );
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    part = xmlGetAllContent( data );  // "Administrative County"
+    part = xmlGetAllContent( table.item( layout.county.row, layout.county.col ) );
     return CreateCommaList( address, part );
 }
 
-wxString GetCensusCitation( wxXmlNode* table, wxXmlNode** link )
+wxString GetCensusCitation( const xmlTableView& table, wxXmlNode** link )
 {
     wxString str;
-    wxXmlNode* row = xmlGetFirstChild( table, "tr" );
-    wxXmlNode* data = xmlGetFirstChild( row, "td" );
-    while( data ) {
-        data = xmlGetNext( data, "td" );
-        if( xmlGetAllContent( data ) == "Source:" ) {
-            data = xmlGetNext( data, "td" );
+    wxXmlNode* data;
+    for( size_t row = 0 ; table.item( row, 0 ) ; row++ ) {
+        if( xmlGetCachedContent( table.item( row, 1 ) ) == "Source:" ) {
+            data = table.item( row, 2 );
             str = xmlGetAllContent( data );
             data = xmlGetFirstChild( data, "scan" );
             if( xmlGetAllContent( data ) == "PRO Ref:" ) {
@@ -244,14 +268,12 @@ wxString GetCensusCitation( wxXmlNode* table, wxXmlNode** link )
             }
             break;
         }
-        row = xmlGetNext( row, "tr" );
-        data = xmlGetFirstChild( row, "td" );
     }
     return str;
 }
 
 void Process1841CensusIndividuals(
-    wxXmlNode* row, idt refID, idt eventID, idt dateID, const wxString& address )
+    const xmlTableView& table, const xmlAnchorIndex& anchors, xmlLinkEdits& edits, size_t row, idt refID, idt eventID, idt dateID, const wxString& address )
 {
     wxXmlNode* data;
     wxXmlNode* aNode;
@@ -266,30 +288,30 @@ void Process1841CensusIndividuals(
     ep.f_eventa_id = eventID;
     ep.f_role_id = recEventTypeRole::ROLE_Census_Listed;
     int personaSeq = 0;
-    while( row ) {
-        data = xmlGetFirstChild( row, "td" );  // In name column.
-        indID = GetIndividualAnchor( data, &name, &aNode );
+    for( ; row < table.row_count() ; row++ ) {
+        data = table.item( row, 0 );  // In name column.
+        indID = GetIndividualAnchor( anchors, data, &name, &aNode );
         if( indID && !name.IsEmpty() ) {
-            data = xmlGetNext( data, "td" );  // Age column.
-            ageID = CreateDateFromAge( data, dateID, refID );
-            data = xmlGetNext( data, "td" );  // In Sex column.
+            data = table.item( row, 1 );  // Age column.
+            ageID = CreateDateFromAge( data, edits, dateID, refID );
+            data = table.item( row, 2 );  // In Sex column.
             sex = GetSexFromStr( xmlGetAllContent( data ) );
 
             idt perID = CreatePersona( refID, indID, name, sex );
-            xmlChangeLink( aNode, recENT_Persona, perID );
+            edits.change( aNode, recENT_Persona, perID );
             // Add persona to Census Event
             ep.f_id = 0;
             ep.f_per_id = perID;
             ep.f_per_seq = ++personaSeq;
             ep.Save();
-            data = xmlGetNext( data, "td" );  // Occupation column.
+            data = table.item( row, 3 );  // Occupation column.
             occ = xmlGetAllContent( data );
             occID = CreateOccupation( occ, refID, perID, dateID );
             if( occID ) {
                 recEventa::CreatePersonalEvent( occID );
-                xmlCreateLink( data, "tfp:"+recEventa::GetIdStr( occID ) );
+                edits.create( data, "tfp:"+recEventa::GetIdStr( occID ) );
             }
-            data = xmlGetNext( data, "td" );  // Same county column.
+            data = table.item( row, 4 );  // Same county column.
             samecountyStr = xmlGetAllContent( data );
             samecountyStr.LowerCase();
             if( samecountyStr.Mid( 0, 1 ) == "y" ) {
@@ -297,7 +319,7 @@ void Process1841CensusIndividuals(
                     bplaceID = CreatePlace( county, refID );
                 }
                 samecounty = true;
-                xmlCreateLink( data, "tfpi:"+recPlace::GetIdStr( bplaceID ) );
+                edits.create( data, "tfpi:"+recPlace::GetIdStr( bplaceID ) );
             } else {
                 samecounty = false;
             }
@@ -305,12 +327,11 @@ void Process1841CensusIndividuals(
                 CreateBirthEvent( refID, perID, ageID, bplaceID );
             }
         }
-        row = xmlGetNext( row, "tr" );
     }
 }
 
 void ProcessCensusIndividuals(
-    wxXmlNode* row, idt refID, idt cen_eaID, idt dateID, idt placeID )
+    const xmlTableView& table, const xmlAnchorIndex& anchors, xmlLinkEdits& edits, size_t row, idt refID, idt cen_eaID, idt dateID, idt placeID )
 {
     wxXmlNode* data;
     wxXmlNode* aNode;
@@ -333,33 +354,33 @@ void ProcessCensusIndividuals(
 
     idt res_eaID = CreateResidenceEventa( dateID, placeID, refID );
 
-    while( row ) {
-        data = xmlGetFirstChild( row, "td" );  // In name column.
-        indID = GetIndividualAnchor( data, &name, &aNode );
+    for( ; row < table.row_count() ; row++ ) {
+        data = table.item( row, 0 );  // In name column.
+        indID = GetIndividualAnchor( anchors, data, &name, &aNode );
         if( indID && !name.IsEmpty() ) {
-            data = xmlGetNext( data, "td" );  // In Relation column.
+            data = table.item( row, 1 );  // In Relation column.
             relStr = xmlGetAllContent( data );
             relNode = data;
             if( dateID == g_1911CensusDateID ) {  // 1911 has different order
-                data = xmlGetNext( data, "td" );  // In Age column.
-                ageID = CreateDateFromAge( data, dateID, refID );
-                data = xmlGetNext( data, "td" );  // In Sex column.
+                data = table.item( row, 2 );  // In Age column.
+                ageID = CreateDateFromAge( data, edits, dateID, refID );
+                data = table.item( row, 3 );  // In Sex column.
                 sex = GetSexFromStr( xmlGetAllContent( data ) );
-                data = xmlGetNext( data, "td" );  // In Marriage column.
+                data = table.item( row, 4 );  // In Marriage column.
                 condStr = xmlGetAllContent( data );
                 condNode = data;
             } else {
-                data = xmlGetNext( data, "td" );  // In Marriage column.
+                data = table.item( row, 2 );  // In Marriage column.
                 condStr = xmlGetAllContent( data );
                 condNode = data;
-                data = xmlGetNext( data, "td" );  // In Age column.
-                ageID = CreateDateFromAge( data, dateID, refID );
-                data = xmlGetNext( data, "td" );  // In Sex column.
+                data = table.item( row, 3 );  // In Age column.
+                ageID = CreateDateFromAge( data, edits, dateID, refID );
+                data = table.item( row, 4 );  // In Sex column.
                 sex = GetSexFromStr( xmlGetAllContent( data ) );
             }
 
             idt perID = CreatePersona( refID, indID, name, sex );
-            xmlChangeLink( aNode, recENT_Persona, perID );
+            edits.change( aNode, recENT_Persona, perID );
             // Add persona to Census Event
             cen_ep.FSetID( 0 );
             cen_ep.FSetPerID( perID );
@@ -387,34 +408,30 @@ void ProcessCensusIndividuals(
                 resRoleID = recEventTypeRole::ROLE_Residence_Family;
             }
             recEventaPersona::CreateLink( res_eaID, perID, resRoleID, relStr );
-            xmlCreateLink( relNode, recENT_Eventa, res_eaID );
+            edits.create( relNode, recENT_Eventa, res_eaID );
 
-            data = xmlGetNext( data, "td" );  // In Birthplace column.
-            bplaceID = CreatePlace( data, refID );
-            xmlCreateLink( data, recENT_Place, bplaceID );
+            data = table.item( row, 5 );  // In Birthplace column.
+            bplaceID = CreatePlace( data, edits, refID );
             attID = CreateCondition( GetConditionStr( sex, condStr ), refID, perID, dateID );
             if( attID ) {
-                xmlCreateLink( condNode, recENT_Eventa, attID );
+                edits.create( condNode, recENT_Eventa, attID );
                 recEventa::CreatePersonalEvent( attID );
             }
             if( ageID || bplaceID ) {
                 CreateBirthEvent( refID, perID, ageID, bplaceID );
             }
             // See if there is an Occupation.
-            row = xmlGetNext( row, "tr" );
-            data = xmlGetFirstChild( row, "td" );
-            data = xmlGetNext( data, "td" );
+            data = table.item( ++row, 1 );
             if( data ) {
-                span = xmlGetFirstChild( data, "span" );
-                span = xmlGetNext( span, "span" );
+                span = xmlGetFirstChild( data, wxXML_ATOM_SPAN );
+                span = xmlGetNext( span, wxXML_ATOM_SPAN );
                 occ = xmlGetAllContent( span );
                 attID = CreateOccupation( occ, refID, perID, dateID );
                 if( attID ) {
-                    xmlCreateLink( span, recENT_Eventa, attID );
+                    edits.create( span, recENT_Eventa, attID );
                 }
             }
         }
-        row = xmlGetNext( row, "tr" );
     }
     if( headPerID != 0 && ( spousePerID != 0 || !childIDs.empty() ) ) {
         // We have a family.
@@ -433,181 +450,125 @@ void ProcessCensusIndividuals(
 }
 
 
-void Create1901UkCensus( idt refID, wxXmlNode* refNode, const wxString& title )
+void Create1901UkCensus(
+    idt refID, wxXmlNode* refNode, const xmlAnchorIndex& anchors, xmlLinkEdits& edits, const wxString& title )
 {
-    wxString address;
-    wxString part;
-    wxXmlNode* row;
-    wxXmlNode* data;
-    wxXmlNode* addrNode;
-    wxXmlNode* table = xmlGetFirstChild( refNode, "table" );
-    // Get address, 1901 files have been structured differently from others
-    // census. We will make the address by combining the "Address", "Civil
-    // Parish" and "Administrative County" fields.
-    // TODO: Institutions (ie R559) have different layout for address
-    row = xmlGetFirstChild( table, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    address = xmlGetAllContent( data ); // "Address"
-    addrNode = data;
-    wxString addrStr = address;
-    row = xmlGetNext( row, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    part = xmlGetAllContent( data );   // "Civil Parish"
-    address = CreateCommaList( address, part );
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    data = xmlGetFirstChild( row, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    data = xmlGetNext( data, "td" );
-    part = xmlGetAllContent( data );  // "Administrative County"
-    address = CreateCommaList( address, part );
+    wxXmlNode* addrNode = nullptr;
+    wxXmlNode* table = xmlGetFirstChild( refNode, wxXML_ATOM_TABLE );
+    xmlTableView view( table );
+    wxString address = GetCensusAddress( view, &addrNode );
     // Carry on.
-    table = xmlGetNext( table, "table" );
-    table = xmlGetNext( table, "table" );
-    row = xmlGetFirstChild( table, "tr" );
-    row = xmlGetNext( row, "tr" );
-    if( !row ) return;
+    table = xmlGetNext( table, wxXML_ATOM_TABLE );
+    table = xmlGetNext( table, wxXML_ATOM_TABLE );
+    view.build( table );
+    if( view.row_count() < 2 ) return;
 
     // We are now comitted to creating the records
     idt placeID = CreatePlace( address, refID );
-    if( addrStr.size() ) {
-        xmlCreateLink( addrNode, recENT_Place, placeID );
+    if( addrNode ) {
+        edits.create( addrNode, recENT_Place, placeID );
     }
     idt eventID = CreateCensusEvent( title, g_1901CensusDateID, placeID, refID );
-    ProcessCensusIndividuals( row, refID, eventID, g_1901CensusDateID, placeID );
+    ProcessCensusIndividuals( view, anchors, edits, 1, refID, eventID, g_1901CensusDateID, placeID );
 }
 
-void CreateUkCensus( 
-    idt refID, idt dateID, idt citID, wxXmlNode* refNode, const wxString& title )
+void CreateUkCensus( idt refID, idt dateID, idt citID,
+    wxXmlNode* refNode, const xmlAnchorIndex& anchors, xmlLinkEdits& edits, const wxString& title )
 {
     int refSeq_ = 0;
-    wxXmlNode* row;
-    wxXmlNode* table = xmlGetFirstChild( refNode, "table" );
+    wxXmlNode* table = xmlGetFirstChild( refNode, wxXML_ATOM_TABLE );
+    xmlTableView view( table );
     wxXmlNode* addrLink = nullptr;
     wxXmlNode* citLink = nullptr;
-    wxString address = GetCensusAddress( table, &addrLink );
-    wxString citation = GetCensusCitation( table, &citLink );
+    wxString address = GetCensusAddress( view, &addrLink );
+    wxString citation = GetCensusCitation( view, &citLink );
     // Get to first person
-    table = xmlGetNext( table, "table" );
-    row = xmlGetFirstChild( table, "tr" );
-    row = xmlGetNext( row, "tr" );
-    if( !row ) return;
+    table = xmlGetNext( table, wxXML_ATOM_TABLE );
+    view.build( table );
+    if( view.row_count() < 2 ) return;
     // We are now comitted to creating the records
     idt placeID = CreatePlace( address, refID );
     if ( addrLink ) {
-        xmlCreateLink( addrLink, recENT_Place, placeID );
+        edits.create( addrLink, recENT_Place, placeID );
     }
     idt full_citID = CreateCitation( citation, citID, refID );
     if( full_citID != 0 ) {
-        xmlCreateLink( citLink, recENT_Citation, full_citID );
+        edits.create( citLink, recENT_Citation, full_citID );
     }
     idt eventID = CreateCensusEvent( title, dateID, placeID, refID );
     if( dateID == g_1841CensusDateID ) {
-        Process1841CensusIndividuals( row, refID, eventID, dateID, address );
+        Process1841CensusIndividuals( view, anchors, edits, 1, refID, eventID, dateID, address );
     } else {
-        ProcessCensusIndividuals( row, refID, eventID, dateID, placeID );
+        ProcessCensusIndividuals( view, anchors, edits, 1, refID, eventID, dateID, placeID );
     }
 }
 
-void CreateIgiBaptism( idt refID, wxXmlNode* refNode )
+// Where the nested tables of an IGI christening page are found, starting
+// from its main table. Each is found once and its cells read through an
+// xmlTableView.
+struct IgiLayout {
+    fiSelector events;   // Birth, christening, death and burial rows.
+    fiSelector parents;  // Father and mother rows.
+};
+
+void CreateIgiBaptism(
+    idt refID, wxXmlNode* refNode, const xmlAnchorIndex& anchors, xmlLinkEdits& edits )
 {
-    wxXmlNode* table;
-    wxXmlNode* row;
-    wxXmlNode* cell;
-    wxXmlNode* table2;
-    wxXmlNode* row2;
-    wxXmlNode* cell2;
+    static const IgiLayout s_igi = {
+        "tr[6]/td[1]/table[0]",
+        "tr[9]/td[1]/table[0]"
+    };
+    wxXmlNode* center;
     wxXmlNode* aNode;
 
     // Read in all data
-    table = xmlGetFirstChild( refNode, "center" );
-    if ( table == nullptr ) {
+    center = xmlGetFirstChild( refNode, wxXML_ATOM_CENTER );
+    if ( center == nullptr ) {
 wxPrintf( "\nRef R" ID " No <center> tag. ", refID );
-        DoCreateElements( refNode, refID );
+        DoCreateElements( refNode, anchors, edits, refID );
         return;
     }
-    table = xmlGetFirstChild( table, "table" );
-    row = xmlGetFirstChild( table, "tr" );
 
-    row = xmlGetNext( row, "tr" );
-    cell = xmlGetFirstChild( row, "td" );
+    xmlTableView view( xmlGetFirstChild( center, wxXML_ATOM_TABLE ) );
+
     wxString name;
-    idt indID = GetIndividualAnchor( cell, &name, &aNode );
+    idt indID = GetIndividualAnchor( anchors, view.item( 1, 0 ), &name, &aNode );
     if ( indID == 0 ) {
 wxPrintf( "\nRef R" ID " No indID found. ", refID );
-        DoCreateElements( refNode, refID );
+        DoCreateElements( refNode, anchors, edits, refID );
         return;
     }
 
-    row = xmlGetNext( row, "tr" );
-    cell = xmlGetFirstChild( row, "td" );
-    cell = xmlGetNext( cell, "td" );
-    Sex sex = GetSexFromStr( xmlGetAllContent( cell ) );
+    Sex sex = GetSexFromStr( xmlGetAllContent( view.item( 2, 1 ) ) );
     idt perID = CreatePersona( refID, indID, name, sex );
-    xmlChangeLink( aNode, recENT_Persona, perID );
-
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    cell = xmlGetFirstChild( row, "td" );
-    cell = xmlGetNext( cell, "td" );
-    table2 = xmlGetFirstChild( cell, "table" );
-    row2 = xmlGetFirstChild( table2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    wxXmlNode* birthEventCell = cell2;
-    cell2 = xmlGetNext( cell2, "td" );
-    wxString birthStr = xmlGetAllContent( cell2 );
-    wxXmlNode* birthDateCell = cell2;
-
-    row2 = xmlGetNext( row2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    wxXmlNode* chrisEventCell = cell2;
-    cell2 = xmlGetNext( cell2, "td" );
-    wxString chrisStr = xmlGetAllContent( cell2 );
-    wxXmlNode* chrisCell = cell2;
-
-    row2 = xmlGetNext( row2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    wxXmlNode* deathEventCell = cell2;
-    cell2 = xmlGetNext( cell2, "td" );
-    wxString deathStr = xmlGetAllContent( cell2 );
-    wxXmlNode* deathCell = cell2;
-
-    row2 = xmlGetNext( row2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    wxXmlNode* burialEventCell = cell2;
-    cell2 = xmlGetNext( cell2, "td" );
-    wxString burialStr = xmlGetAllContent( cell2 );
-    wxXmlNode* burialCell = cell2;
-
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    row = xmlGetNext( row, "tr" );
-    cell = xmlGetFirstChild( row, "td" );
-    cell = xmlGetNext( cell, "td" );
-    table2 = xmlGetFirstChild( cell, "table" );
-    row2 = xmlGetFirstChild( table2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    cell2 = xmlGetNext( cell2, "td" );
-    idt fatherIndID = GetIndividualAnchor( cell2, &name, &aNode );
+    edits.change( aNode, recENT_Persona, perID );
+
+    xmlTableView events( s_igi.events.find( view.table() ) );
+    wxXmlNode* birthEventCell = events.item( 0, 0 );
+    wxXmlNode* birthDateCell = events.item( 0, 1 );
+    wxString birthStr = xmlGetAllContent( birthDateCell );
+
+    wxXmlNode* chrisEventCell = events.item( 1, 0 );
+    wxXmlNode* chrisCell = events.item( 1, 1 );
+    wxString chrisStr = xmlGetAllContent( chrisCell );
+
+    wxXmlNode* deathEventCell = events.item( 2, 0 );
+    wxXmlNode* deathCell = events.item( 2, 1 );
+    wxString deathStr = xmlGetAllContent( deathCell );
+
+    wxXmlNode* burialEventCell = events.item( 3, 0 );
+    wxXmlNode* burialCell = events.item( 3, 1 );
+    wxString burialStr = xmlGetAllContent( burialCell );
+
+    xmlTableView parents( s_igi.parents.find( view.table() ) );
+    idt fatherIndID = GetIndividualAnchor( anchors, parents.item( 0, 1 ), &name, &aNode );
     idt fatherPerID = 0;
     if( !name.IsEmpty() ) {
         fatherPerID = CreatePersona( refID, fatherIndID, name, Sex::male );
-        xmlChangeLink( aNode, recENT_Persona, fatherPerID );
+        edits.change( aNode, recENT_Persona, fatherPerID );
     }
 
-    row2 = xmlGetNext( row2, "tr" );
-    cell2 = xmlGetFirstChild( row2, "td" );
-    cell2 = xmlGetNext( cell2, "td" );
-    idt motherIndID = GetIndividualAnchor( cell2, &name, &aNode );
+    idt motherIndID = GetIndividualAnchor( anchors, parents.item( 1, 1 ), &name, &aNode );
     idt motherPerID = 0;
     if( !name.IsEmpty() ) {
 //        idt nameID =  recPersona::GetNameID( fatherPerID );
@@ -615,7 +576,7 @@ wxPrintf( "\nRef R" ID " No indID found. ", refID );
 //        motherPerID = CreatePersona( refID, motherIndID, nameID, SEX_Female );
         // Assume name is just given name so add '?' for birth surname
         motherPerID = CreatePersona( refID, motherIndID, name+" ?", Sex::female );
-        xmlChangeLink( aNode, recENT_Persona, motherPerID );
+        edits.change( aNode, recENT_Persona, motherPerID );
     }
 
     idt dateID;
@@ -630,8 +591,8 @@ wxPrintf( "\nRef R" ID " No indID found. ", refID );
         LinkOrCreateEventFromEventa( eaID );
 //        xmlCreateLink( birthDateCell, "tfpi:"+recDate::GetIdStr( dateID ) );
 //        xmlCreateLink( birthEventCell, 0, 5, "tfp:"+recEventa::GetIdStr( eaID ) );
-        xmlCreateLink( birthDateCell, recENT_Date, dateID );
-        xmlCreateLink( birthEventCell, recENT_Eventa, eaID );
+        edits.create( birthDateCell, recENT_Date, dateID );
+        edits.create( birthEventCell, recENT_Eventa, eaID );
     }
     if( !chrisStr.empty() ) {
         wxString chrisDateStr, chrisPlaceStr;
@@ -648,25 +609,27 @@ wxPrintf( "\nRef R" ID " No indID found. ", refID );
         AddPersonaToEventa( eaID, fatherPerID, recEventTypeRole::ROLE_Baptism_Parent );
         AddPersonaToEventa( eaID, motherPerID, recEventTypeRole::ROLE_Baptism_Parent );
         LinkOrCreateEventFromEventa( eaID );
-        wxXmlNode* link = xmlCreateLink( chrisCell, 0, pos, recENT_Date, dateID );
-        xmlCreateLink( link->GetNext(), 2, -1, recENT_Place, placeID );
-        xmlCreateLink( chrisEventCell, 0, 11, recENT_Eventa, eaID );
+        edits.create( chrisCell, 0, pos, recENT_Date, dateID );
+        if( pos != wxNOT_FOUND ) {
+            edits.create( chrisCell, pos + 2, -1, recENT_Place, placeID );
+        }
+        edits.create( chrisEventCell, 0, 11, recENT_Eventa, eaID );
     }
     if( !deathStr.IsEmpty() ) {
         dateID = CreateDate( deathStr, refID );
         placeID = 0;
         eaID = CreateDeathEventa( refID, perID, dateID, placeID );
         LinkOrCreateEventFromEventa( eaID );
-        xmlCreateLink( deathCell, recENT_Date, dateID );
-        xmlCreateLink( deathEventCell, 0, 5, recENT_Eventa, eaID );
+        edits.create( deathCell, recENT_Date, dateID );
+        edits.create( deathEventCell, 0, 5, recENT_Eventa, eaID );
     }
     if( !burialStr.IsEmpty() ) {
         dateID = CreateDate( burialStr, refID );
         placeID = 0;
         eaID = CreateBurialEventa( refID, perID, dateID, placeID );
         LinkOrCreateEventFromEventa( eaID );
-        xmlCreateLink( burialCell, recENT_Date, dateID );
-        xmlCreateLink( burialEventCell, 0, 6, recENT_Eventa, eaID );
+        edits.create( burialCell, recENT_Date, dateID );
+        edits.create( burialEventCell, 0, 6, recENT_Eventa, eaID );
     }
     if( fatherPerID ) {
         eaID = CreateFamilyRelEventa( refID, fatherPerID, refDateID, 0 );
@@ -686,61 +649,66 @@ enum IntRefReturn {
     INTREF_Done, INTREF_Custom
 };
 
-IntRefReturn InterpretRef( idt refID, const wxString& classAt, const wxString& title, wxXmlNode* refNode )
+IntRefReturn InterpretRef(
+    idt refID, const wxString& classAt, const wxString& title, wxXmlNode* refNode,
+    const xmlAnchorIndex& anchors, ReferenceWriter& writer )
 {
-    wxString refClass = refNode->GetAttribute( "class" );
+    wxString refClass = refNode->GetAttribute( wxXML_ATOM_CLASS );
     if( refClass == "custom" ) {
         return INTREF_Custom;
     }
-    wxString refFormat = refNode->GetAttribute( "id" );
+    wxString refFormat = refNode->GetAttribute( wxXML_ATOM_ID );
     idt higher_refID = 0;
+    xmlLinkEdits edits;
 
     if ( classAt == "property" ) {
-        DoCreateElements( refNode, refID );
+        DoCreateElements( refNode, anchors, edits, refID );
     } else if( classAt == "igi-chr" /*&& refFormat != "vri-tab"*/ ) {
-        CreateIgiBaptism( refID, refNode );
+        CreateIgiBaptism( refID, refNode, anchors, edits );
     } else if( refFormat == "census-tab" ) {
         long year;
         title.ToLong( &year );
         if( year == 1841 ) {
-            CreateUkCensus( refID, g_1841CensusDateID, g_1841CitationID, refNode, title );
+            CreateUkCensus( refID, g_1841CensusDateID, g_1841CitationID, refNode, anchors, edits, title );
             higher_refID = -1;
         } else if( year == 1851 ) {
-            CreateUkCensus( refID, g_1851CensusDateID, g_1851CitationID, refNode, title );
+            CreateUkCensus( refID, g_1851CensusDateID, g_1851CitationID, refNode, anchors, edits, title );
             higher_refID = -2;
         } else if( year == 1861 ) {
-            CreateUkCensus( refID, g_1861CensusDateID, g_1861CitationID, refNode, title );
+            CreateUkCensus( refID, g_1861CensusDateID, g_1861CitationID, refNode, anchors, edits, title );
             higher_refID = -3;
         } else if( year == 1871 ) {
-            CreateUkCensus( refID, g_1871CensusDateID, g_1871CitationID, refNode, title );
+            CreateUkCensus( refID, g_1871CensusDateID, g_1871CitationID, refNode, anchors, edits, title );
             higher_refID = -4;
         } else if( year == 1881 ) {
-            CreateUkCensus( refID, g_1881CensusDateID, g_1881CitationID, refNode, title );
+            CreateUkCensus( refID, g_1881CensusDateID, g_1881CitationID, refNode, anchors, edits, title );
             higher_refID = -5;
         } else if( year == 1891 ) {
-            CreateUkCensus( refID, g_1891CensusDateID, g_1891CitationID, refNode, title );
+            CreateUkCensus( refID, g_1891CensusDateID, g_1891CitationID, refNode, anchors, edits, title );
             higher_refID = -6;
         } else if( year == 1901 ) {
-            Create1901UkCensus( refID, refNode, title );
+            Create1901UkCensus( refID, refNode, anchors, edits, title );
             higher_refID = -7;
         } else if( year == 1911 ) {
-            CreateUkCensus( refID, g_1911CensusDateID, g_1911CitationID, refNode, title );
+            CreateUkCensus( refID, g_1911CensusDateID, g_1911CitationID, refNode, anchors, edits, title );
             higher_refID = -8;
         }
     } else {
-        DoCreateElements( refNode, refID );
+        DoCreateElements( refNode, anchors, edits, refID );
+    }
+    size_t dropped = edits.apply();
+    if( dropped && g_verbose ) {
+        wxPrintf( "\nRef R" ID " %d overlapping links dropped. ", refID, (int) dropped );
     }
 
-    wxString refStr = "<!-- HTML -->\n" + xmlGetSource( refNode );
     recReference ref(0);
     ref.FSetID( refID );
     ref.FSetHigherID( higher_refID );
     ref.FSetTitle( title );
-    ref.FSetStatement( refStr );
     ref.FSetResID( 1 );
     ref.FSetUserRef( "RD"+recGetStr( refID ) );
     ref.CreateUidChanged();
-    ref.Save();
+    writer.save( ref, refNode );
     return INTREF_Done;
 }
 
@@ -749,8 +717,8 @@ void AddToMediaList( idt refID, wxXmlNode* node, MediaVec& media )
     Media m;
     m.ref = refID;
     for ( wxXmlNode* child = node->GetChildren(); child; child = child->GetNext() ) {
-        if ( child->GetName() != "a" ) continue;
-        wxString href = child->GetAttribute( "href" );
+        if ( child->GetAtom() != wxXML_ATOM_A ) continue;
+        wxString href = child->GetAttribute( wxXML_ATOM_HREF );
         if ( href.StartsWith( "../or/", &m.filename ) ) {
             m.text = xmlGetAllContent( child );
             media.push_back( m );
@@ -758,17 +726,41 @@ void AddToMediaList( idt refID, wxXmlNode* node, MediaVec& media )
     }
 }
 
+// The page head, the top menu and the navigation spans are never read, so
+// are left unparsed. Anything that does look inside them still can.
+bool IsRefBoilerplate( const wxXmlNode* node )
+{
+    switch( node->GetAtom() )
+    {
+    case wxXML_ATOM_HEAD:
+        return true;
+    case wxXML_ATOM_DIV:
+        return node->GetAttribute( wxXML_ATOM_ID ) == "topmenu";
+    case wxXML_ATOM_SPAN:
+        {
+            wxString classAt = node->GetAttribute( wxXML_ATOM_CLASS );
+            return classAt.StartsWith( "hmenu" ) && classAt != "hmenu orig";
+        }
+    default:
+        return false;
+    }
+}
+
 
 // If the reference file has markup (body element has id attribute - see rd00393.htm)
 // then is processed by ProcessMarkupRef(...) else is processed by
 // InterpretRef(...) or added to custom list.
-void ProcessRefFile( const wxString path, idt refID, Filenames& customs, MediaVec& media )
+void ProcessRefFile(
+    const wxString path, idt refID, Filenames& customs, MediaVec& media, ReferenceWriter& writer )
 {
     wxFileName fn( path );
     wxString title;
 
     wxXmlDocument doc;
-    if( !doc.Load( fn.GetFullPath(), "UTF-8", wxXMLDOC_KEEP_WHITESPACE_NODES ) ) {
+    doc.SetLazyFilter( IsRefBoilerplate );
+    if( !doc.Load( fn.GetFullPath(), "UTF-8",
+        wxXMLDOC_KEEP_WHITESPACE_NODES | wxXMLDOC_KEEP_SOURCE | wxXMLDOC_LAZY |
+        wxXMLDOC_INDEX_ANCHORS ) ) {
         wxPrintf( "\nRef (" ID ") filename: [%s]\n\n", refID, fn.GetFullPath() );
         return;
     }
@@ -780,21 +772,21 @@ void ProcessRefFile( const wxString path, idt refID, Filenames& customs, MediaVe
     wxString classAt;
     wxString h1Class;
     while( child ) {
-        if (child->GetName() == "body") {
-            classAt = child->GetAttribute( "class" );
-            idAttr = child->GetAttribute( "id" );
+        if (child->GetAtom() == wxXML_ATOM_BODY) {
+            classAt = child->GetAttribute( wxXML_ATOM_CLASS );
+            idAttr = child->GetAttribute( wxXML_ATOM_ID );
             if( idAttr.size() ) {
 //                wxPrintf( "\nMarked-up document [%s] ", fn.GetFullPath() );
-                ProcessMarkupRef( refID, root );
+                ProcessMarkupRef( refID, root, writer );
                 return;
             }
             child = child->GetChildren();
             continue;
-        } else if (child->GetName() == "h1") {
-            h1Class = child->GetAttribute( "class" );
+        } else if (child->GetAtom() == wxXML_ATOM_H1) {
+            h1Class = child->GetAttribute( wxXML_ATOM_CLASS );
             title = xmlGetAllContent( child );
-        } else if( child->GetName() == "div" ) {
-            idAttr = child->GetAttribute( "id" );
+        } else if( child->GetAtom() == wxXML_ATOM_DIV ) {
+            idAttr = child->GetAttribute( wxXML_ATOM_ID );
             if ( idAttr == "blank" ) {
                 break;
             }
@@ -803,7 +795,7 @@ void ProcessRefFile( const wxString path, idt refID, Filenames& customs, MediaVe
                 refNode = child;
                 break;
             }
-        } else if ( child->GetName() == "span" && child->GetAttribute( "class" ) == "hmenu orig" ) {
+        } else if ( child->GetAtom() == wxXML_ATOM_SPAN && child->GetAttribute( wxXML_ATOM_CLASS ) == "hmenu orig" ) {
             AddToMediaList( refID, child, media );
         }
         child = child->GetNext();
@@ -812,8 +804,9 @@ void ProcessRefFile( const wxString path, idt refID, Filenames& customs, MediaVe
         classAt = h1Class;
     }
     if( refNode ) {
+        xmlAnchorIndex anchors( doc );
         IntRefReturn ret;
-        ret = InterpretRef( refID, classAt, title, refNode );
+        ret = InterpretRef( refID, classAt, title, refNode, anchors, writer );
         if( ret == INTREF_Custom ) {
             customs.push_back( fn );
         }
@@ -825,6 +818,7 @@ bool InputRefFiles( const wxString& refFolder, MediaVec& media )
     CreateSourceGlobals();
 
     Filenames customs;
+    ReferenceWriter writer;
     wxString rddirname;
 
     wxDir dir( refFolder );
@@ -847,7 +841,7 @@ bool InputRefFiles( const wxString& refFolder, MediaVec& media )
 //                wxPrintf( "File: %s\n", rdfilename );
 //            }
             wxString path = refFolder + "/" + rddirname + "/" + rdfilename;
-            ProcessRefFile( path, refID, customs, media );
+            ProcessRefFile( path, refID, customs, media, writer );
             cont = rddir.GetNext( &rdfilename );
         }
         cont = dir.GetNext( &rddirname );
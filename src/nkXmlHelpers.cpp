@@ -37,6 +37,8 @@
 
 #include <wx/sstream.h>
 
+#include <algorithm>
+
 #include "nkMain.h"
 #include "xml2.h"
 
@@ -44,24 +46,158 @@ wxString xmlGetSource( wxXmlNode* node )
 {
     if( !node ) return wxEmptyString;
 
-    wxString str;
-    wxStringOutputStream output( &str );
-    wxXmlDocument doc;
-    wxXmlNode* root = new wxXmlNode( NULL, node->GetType(), node->GetName() );
-    root->SetAttributes( node->GetAttributes() );
-    root->SetChildren( node->GetChildren() );
-    doc.SetRoot( root );
-    doc.Save( output, 0, wxXMLDOC_SAVE_NONE );
-    root->SetAttributes( NULL );
-    root->SetChildren( NULL );
-    return str;
+    // The buffer is kept between calls so it only grows to fit the
+    // largest reference seen.
+    static std::string str;
+    str.clear();
+    xmlAppendSource( node, str );
+    return wxString::FromUTF8( str.data(), str.length() );
 }
 
-wxString xmlGetAllContent( wxXmlNode* node )
+void xmlAppendSource( wxXmlNode* node, std::string& out )
 {
-    if( !node ) return wxEmptyString;
+    if( !node ) return;
 
-    wxString str;
+    wxXmlDocument::Save( node, out );
+    out += '\n';
+}
+
+namespace {
+
+// Elements that are rendered on lines of their own. A text node holding
+// only whitespace is never seen when it is next to one of them, or is the
+// first or last child of one.
+bool xmlIsBlock( wxXmlNode* node )
+{
+    if( node->GetType() == wxXML_DOCUMENT_NODE ) {
+        return true;
+    }
+    if( node->GetType() != wxXML_ELEMENT_NODE ) {
+        return false;
+    }
+    switch( node->GetAtom() )
+    {
+    case wxXML_ATOM_BODY: case wxXML_ATOM_BR: case wxXML_ATOM_CENTER:
+    case wxXML_ATOM_DIV: case wxXML_ATOM_H1: case wxXML_ATOM_H2:
+    case wxXML_ATOM_H3: case wxXML_ATOM_HEAD: case wxXML_ATOM_HTML:
+    case wxXML_ATOM_LI: case wxXML_ATOM_LINK: case wxXML_ATOM_META:
+    case wxXML_ATOM_P: case wxXML_ATOM_PRE: case wxXML_ATOM_TABLE:
+    case wxXML_ATOM_TBODY: case wxXML_ATOM_TD: case wxXML_ATOM_TH:
+    case wxXML_ATOM_TITLE: case wxXML_ATOM_TR: case wxXML_ATOM_UL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Elements whose text and comments must be kept as they are.
+bool xmlIsVerbatim( wxXmlNode* node )
+{
+    switch( node->GetAtom() )
+    {
+    case wxXML_ATOM_PRE: case wxXML_ATOM_STYLE:
+        return true;
+    case wxXML_ATOM_UNKNOWN:
+        return node->GetName().IsSameAs( "script", false )
+            || node->GetName().IsSameAs( "textarea", false );
+    default:
+        return false;
+    }
+}
+
+// Copies str to out with each run of spaces, tabs and line ends made a
+// single space. Returns false if out is the same as str.
+bool xmlCollapseSpace( const wxString& str, wxString& out )
+{
+    out.clear();
+    bool changed = false;
+    bool space = false;
+    for( wxString::const_iterator it = str.begin() ; it != str.end() ; ++it ) {
+        wxUniChar ch = *it;
+        if( ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' ) {
+            if( space || ch != ' ' ) {
+                changed = true;
+            }
+            if( !space ) {
+                out += ' ';
+            }
+            space = true;
+        } else {
+            out += ch;
+            space = false;
+        }
+    }
+    return changed;
+}
+
+void xmlMinifyChildren( wxXmlNode* parent, bool pre, wxString& buf )
+{
+    bool block = xmlIsBlock( parent );
+    wxXmlNode* prev = nullptr;
+    wxXmlNode* node = parent->GetChildren();
+    while( node ) {
+        wxXmlNode* next = node->GetNext();
+        bool drop = false;
+        switch( node->GetType() )
+        {
+        case wxXML_COMMENT_NODE:
+            if( pre ) break;
+            drop = node->GetContent().Strip( wxString::both ) != "HTML";
+            break;
+        case wxXML_ELEMENT_NODE:
+            xmlMinifyChildren( node, pre || xmlIsVerbatim( node ), buf );
+            break;
+        case wxXML_TEXT_NODE:
+            if( pre ) break;
+            if( xmlCollapseSpace( node->GetContent(), buf ) ) {
+                node->SetContent( buf );
+            }
+            if( buf == " " && block ) {
+                // Look past any comments, they are about to go.
+                wxXmlNode* after = next;
+                while( after && after->GetType() == wxXML_COMMENT_NODE ) {
+                    after = after->GetNext();
+                }
+                drop = !prev || xmlIsBlock( prev ) || !after || xmlIsBlock( after );
+            }
+            break;
+        default:
+            break;
+        }
+        if( drop ) {
+            parent->RemoveChild( node );
+            delete node;
+        } else {
+            prev = node;
+        }
+        node = next;
+    }
+}
+
+} // namespace
+
+void xmlMinify( wxXmlNode* node )
+{
+    if( !node ) return;
+
+    wxString buf;
+    xmlMinifyChildren( node, xmlIsVerbatim( node ), buf );
+}
+
+namespace {
+
+// The text of a node already worked out, if any.
+bool xmlAppendCached( wxXmlNode* node, wxString& str )
+{
+    const wxString* text = node->GetCachedText();
+    if( text ) {
+        str << *text;
+    }
+    return text != nullptr;
+}
+
+void xmlAppendContentOf( wxXmlNode* node, wxString& str )
+{
     wxXmlNode* child = node->GetChildren();
     while( child ) {
         switch( child->GetType() )
@@ -71,18 +207,50 @@ wxString xmlGetAllContent( wxXmlNode* node )
             str << child->GetContent();
             break;
         case wxXML_ELEMENT_NODE:
-            if( child->GetName() == "br" ) {
+            if( child->GetAtom() == wxXML_ATOM_BR ) {
                 str << " ";
                 break;
             }
-            str << xmlGetAllContent( child );
+            if( !xmlAppendCached( child, str ) ) {
+                xmlAppendContentOf( child, str );
+            }
             break;
         }
         child = child->GetNext();
     }
+}
+
+} // namespace
+
+wxString xmlGetAllContent( wxXmlNode* node )
+{
+    wxString str;
+    xmlAppendAllContent( node, str );
     return str;
 }
 
+const wxString& xmlGetCachedContent( wxXmlNode* node )
+{
+    static const wxString s_empty;
+    if( !node ) return s_empty;
+
+    const wxString* text = node->GetCachedText();
+    if( !text ) {
+        wxString str;
+        xmlAppendContentOf( node, str );
+        node->SetCachedText( str );
+        text = node->GetCachedText();
+    }
+    return *text;
+}
+
+void xmlAppendAllContent( wxXmlNode* node, wxString& str )
+{
+    if( node && !xmlAppendCached( node, str ) ) {
+        xmlAppendContentOf( node, str );
+    }
+}
+
 wxXmlNode* xmlGetFirstText( wxXmlNode* node )
 {
     if( !node ) return NULL;
@@ -130,67 +298,238 @@ wxXmlNode* xmlGetFirstChild( wxXmlNode* node, const wxString& tag )
     return xmlGetFirst( xmlGetChild( node ), tag );
 }
 
-wxXmlNode* xmlGetFirstTag( wxXmlNode* node, const wxString & tag )
+wxXmlNode* xmlGetFirst( wxXmlNode* node, wxXmlAtom tag )
+{
+    while( node && node->GetAtom() != tag ) {
+        node = node->GetNext();
+    }
+    return node;
+}
+
+wxXmlNode* xmlGetNext( wxXmlNode* node, wxXmlAtom tag )
 {
-    if ( node->GetType() == wxXML_ELEMENT_NODE && node->GetName() == tag ) {
-        return node;
+    if( node ) {
+        node = node->GetNext();
     }
-    return xmlGetNextTag( node, tag );
+    return xmlGetFirst( node, tag );
+}
+
+wxXmlNode* xmlGetFirstChild( wxXmlNode* node, wxXmlAtom tag )
+{
+    return xmlGetFirst( xmlGetChild( node ), tag );
+}
+
+wxXmlNode* xmlGetFirstTag( wxXmlNode* node, const wxString& tag )
+{
+    return wxXmlWalk( node, [&]( wxXmlNode* n, wxXmlWalkOrder ) {
+        if( n->GetType() == wxXML_ELEMENT_NODE && n->GetName() == tag ) {
+            return wxXML_WALK_STOP;
+        }
+        return wxXML_WALK_CONTINUE;
+    } );
 }
 
+// As xmlGetFirstTag, but node itself is not a match.
 wxXmlNode* xmlGetNextTag( wxXmlNode* node, const wxString& tag )
 {
-    wxXmlNode* next = node->GetChildren();
-    next = xmlGetFirstTag( next, tag );
-    if ( next ) {
-        return next;
+    return wxXmlWalk( node, [&]( wxXmlNode* n, wxXmlWalkOrder ) {
+        if( n != node && n->GetType() == wxXML_ELEMENT_NODE && n->GetName() == tag ) {
+            return wxXML_WALK_STOP;
+        }
+        return wxXML_WALK_CONTINUE;
+    } );
+}
+
+namespace {
+
+size_t xmlGetSpan( wxXmlNode* cell, wxXmlAtom attr, size_t max )
+{
+    wxString str;
+    unsigned long span;
+    if( !cell->GetAttribute( attr, &str ) || !str.ToULong( &span ) || span < 1 ) {
+        return 1;
     }
-    for ( ;; ) {
-        next = node->GetNext();
-        if ( next == 0 ) {
-            break;
+    return span > max ? max : span;
+}
+
+} // namespace
+
+void xmlTableView::build( wxXmlNode* table )
+{
+    m_table = table;
+    m_rows.clear();
+    m_itemStart.clear();
+    m_items.clear();
+    m_grid.clear();
+    m_cols = 0;
+
+    struct Placed {
+        wxXmlNode* node;
+        size_t row, col, rows, cols;
+    };
+    std::vector<Placed> placed;
+    std::vector<size_t> busy; // Rows still covered by a rowspan, per column.
+
+    for( wxXmlNode* tr = xmlGetChild( table ) ; tr ; tr = tr->GetNext() ) {
+        if( tr->GetAtom() != wxXML_ATOM_TR ) continue;
+        size_t r = m_rows.size();
+        m_rows.push_back( tr );
+        m_itemStart.push_back( m_items.size() );
+        size_t col = 0;
+        for( wxXmlNode* td = tr->GetChildren() ; td ; td = td->GetNext() ) {
+            wxXmlAtom atom = td->GetAtom();
+            if( atom == wxXML_ATOM_TD ) {
+                m_items.push_back( td );
+            } else if( atom != wxXML_ATOM_TH ) {
+                continue;
+            }
+            while( col < busy.size() && busy[col] ) {
+                col++;
+            }
+            // Limits are those given by HTML5.
+            Placed p = {
+                td, r, col,
+                xmlGetSpan( td, wxXML_ATOM_ROWSPAN, 65534 ),
+                xmlGetSpan( td, wxXML_ATOM_COLSPAN, 1000 )
+            };
+            placed.push_back( p );
+            if( busy.size() < col + p.cols ) {
+                busy.resize( col + p.cols, 0 );
+            }
+            for( size_t c = col ; c < col + p.cols ; c++ ) {
+                busy[c] = p.rows;
+            }
+            col += p.cols;
+        }
+        for( size_t c = 0 ; c < busy.size() ; c++ ) {
+            if( busy[c] ) busy[c]--;
         }
-        next = xmlGetFirstTag( next, tag );
-        if ( next ) {
-            return next;
+    }
+    m_itemStart.push_back( m_items.size() );
+
+    m_cols = busy.size();
+    m_grid.assign( m_rows.size() * m_cols, nullptr );
+    for( size_t i = 0 ; i < placed.size() ; i++ ) {
+        const Placed& p = placed[i];
+        for( size_t r = p.row ; r < p.row + p.rows && r < m_rows.size() ; r++ ) {
+            for( size_t c = p.col ; c < p.col + p.cols ; c++ ) {
+                m_grid[r * m_cols + c] = p.node;
+            }
         }
     }
-    
+}
 
+wxXmlNode* xmlTableView::item( size_t r, size_t n ) const
+{
+    if( r >= m_rows.size() || n >= m_itemStart[r+1] - m_itemStart[r] ) {
+        return nullptr;
+    }
+    return m_items[m_itemStart[r] + n];
+}
 
+wxXmlNode* xmlTableView::cell( size_t r, size_t col ) const
+{
+    if( r >= m_rows.size() || col >= m_cols ) {
+        return nullptr;
+    }
+    return m_grid[r * m_cols + col];
+}
 
-    while ( node ) {
-        if ( node->GetType() == wxXML_ELEMENT_NODE ) {
-            if ( node->GetName() == tag ) {
-                return node;
-            } else {
-                return xmlGetNextTag( node->GetChildren(), tag );
+void xmlAnchorIndex::build( const wxXmlDocument& doc )
+{
+    const std::vector<wxXmlNode*>& nodes = doc.GetAnchors();
+    m_anchors.clear();
+    m_anchors.reserve( nodes.size() );
+    m_nodes.clear();
+    m_nodes.reserve( nodes.size() );
+    m_regions.clear();
+    for( size_t i = 0 ; i < nodes.size() ; i++ ) {
+        xmlAnchor a;
+        a.node = nodes[i];
+        HrefLink link;
+        const wxXmlAttribute* href = a.node->FindAttribute( wxXML_ATOM_HREF );
+        if( href && ParseHref( href->GetValue(), &link ) ) {
+            a.entity = link.entity;
+            a.id = link.id;
+            a.old = link.old;
+        } else {
+            a.entity = recENT_NULL;
+            a.id = 0;
+            a.old = false;
+        }
+        m_nodes.insert( std::make_pair( a.node, i ) );
+        m_anchors.push_back( a );
+        // The anchors come in document order, so each element holding
+        // them covers one run of entries.
+        for( wxXmlNode* n = a.node ; n ; n = n->GetParent() ) {
+            auto ins = m_regions.insert( std::make_pair( n, Range( i, i + 1 ) ) );
+            if( !ins.second ) {
+                ins.first->second.second = i + 1;
             }
         }
-        node = node->GetNext();
     }
-    return 0;
 }
 
-idt GetIndividualAnchor( wxXmlNode* node, wxString* name, wxXmlNode** aNode )
+void xmlAnchorIndex::range( wxXmlNode* region, size_t* begin, size_t* end ) const
 {
-    while ( node ) {
-        if ( node->GetType() == wxXML_ELEMENT_NODE ) {
-            if ( node->GetName() == "a" ) {
-                *aNode = node;
-                wxString href = node->GetAttribute( "href" );
-                idt id;
-                if ( DecodeHref( href, &id, NULL ) ) {
-                    *name = xmlGetAllContent( node );
-                }
-                return id;
-            } else {
-                return GetIndividualAnchor( node->GetChildren(), name, aNode );
-            }
+    auto it = m_regions.find( region );
+    if( it == m_regions.end() ) {
+        *begin = *end = 0;
+        return;
+    }
+    *begin = it->second.first;
+    *end = it->second.second;
+}
+
+void xmlAnchorIndex::range_from( wxXmlNode* node, size_t* begin, size_t* end ) const
+{
+    wxXmlNode* parent = node->GetParent();
+    if( !parent ) {
+        range( node, begin, end );
+        return;
+    }
+    // The run ends with the parent's, and starts with the first of the
+    // siblings to hold an anchor.
+    size_t first;
+    range( parent, &first, end );
+    *begin = *end;
+    for( ; node && *begin == *end ; node = node->GetNext() ) {
+        auto it = m_regions.find( node );
+        if( it != m_regions.end() ) {
+            *begin = it->second.first;
         }
-        node = node->GetNext();
     }
-    return 0;
+}
+
+const xmlAnchor* xmlAnchorIndex::find( wxXmlNode* node ) const
+{
+    auto it = m_nodes.find( node );
+    return it == m_nodes.end() ? nullptr : &m_anchors[it->second];
+}
+
+// Follows the first element child of the cell, and of each element below
+// it, down to an <a> element. If that links to an individual, returns the
+// individual's ID and the link text as name.
+idt GetIndividualAnchor(
+    const xmlAnchorIndex& anchors, wxXmlNode* cell, wxString* name, wxXmlNode** aNode )
+{
+    wxXmlNode* node = cell;
+    while( node && node->GetAtom() != wxXML_ATOM_A ) {
+        node = node->GetChildren();
+        while( node && node->GetType() != wxXML_ELEMENT_NODE ) {
+            node = node->GetNext();
+        }
+    }
+    const xmlAnchor* a = anchors.find( node );
+    if( !a ) {
+        return 0;
+    }
+    *aNode = a->node;
+    if( a->entity != recENT_Individual || a->id < 1 ) {
+        return 0;
+    }
+    *name = xmlGetAllContent( a->node );
+    return a->id;
 }
 
 wxString xmlReadRecLoc( const wxString& str )
@@ -205,13 +544,13 @@ wxString xmlReadRecLoc( const wxString& str )
     wxStringInputStream sis( input );
     if( doc.Load( sis ) ) {
         wxXmlNode* node = doc.GetRoot();
-        node = xmlGetFirst( node->GetChildren(), "body" );
-        node = xmlGetFirst( node->GetChildren(), "table" );
-        node = xmlGetFirst( node->GetChildren(), "tr" );
-        node = xmlGetFirst( node->GetChildren(), "td" );
-        node = xmlGetNext( node, "td" );
-        if( xmlGetAllContent( node ) == "Address:" ) {
-            node = xmlGetNext( node, "td" );
+        node = xmlGetFirst( node->GetChildren(), wxXML_ATOM_BODY );
+        node = xmlGetFirst( node->GetChildren(), wxXML_ATOM_TABLE );
+        node = xmlGetFirst( node->GetChildren(), wxXML_ATOM_TR );
+        node = xmlGetFirst( node->GetChildren(), wxXML_ATOM_TD );
+        node = xmlGetNext( node, wxXML_ATOM_TD );
+        if( xmlGetCachedContent( node ) == "Address:" ) {
+            node = xmlGetNext( node, wxXML_ATOM_TD );
             address = xmlGetAllContent( node );
         }
     }
@@ -247,124 +586,236 @@ wxXmlNode* xmlCreateLink( wxXmlNode* node, int beg, int end, const wxString& hre
     } 
     if( beg >= end ) return NULL;
     wxString begStr = str.Mid( 0, beg );
-    wxString midStr = str.Mid( beg, end );
+    wxString midStr = str.Mid( beg, end - beg );
     wxString endStr = str.Mid( end );
 
     wxXmlNode* parent = node->GetParent();
-    wxXmlNode* elderSibling = NULL;
-    for( wxXmlNode* n = parent->GetChildren() ; n != node ; n = n->GetNext() ) {
-        wxASSERT( n != NULL );
-        elderSibling = n;
-    }
-    wxXmlNode* youngerSibling = node->GetNext();
-
     wxXmlNode* link = new wxXmlNode( wxXML_ELEMENT_NODE, "a" );
     link->AddAttribute( "href", href );
-    link->SetParent( parent );
-    link->SetChildren( node );
+    parent->InsertChild( link, node );
+    parent->RemoveChild( node );
     node->SetContent( midStr );
-    node->SetParent( link );
-    node->SetNext( NULL );
+    link->AddChild( node );
 
     if( begStr.size() ) {
-        wxXmlNode* begNode = new wxXmlNode( wxXML_TEXT_NODE, "text", begStr );
-        begNode->SetParent( parent );
-        if( elderSibling == NULL ) {
-            parent->SetChildren( begNode );
-        } else {
-            elderSibling->SetNext( begNode );
-        }
-        elderSibling = begNode;
-    }
-
-    if( elderSibling == NULL ) {
-        parent->SetChildren( link );
-    } else {
-        elderSibling->SetNext( link );
+        parent->InsertChild( new wxXmlNode( wxXML_TEXT_NODE, "text", begStr ), link );
     }
-
     if( endStr.size() ) {
-        wxXmlNode* endNode = new wxXmlNode( wxXML_TEXT_NODE, "text", endStr );
-        endNode->SetParent( parent );
-        link->SetNext( endNode );
-        endNode->SetNext( youngerSibling );
-    } else {
-        link->SetNext( youngerSibling );
+        parent->InsertChildAfter( new wxXmlNode( wxXML_TEXT_NODE, "text", endStr ), link );
     }
     return link;
 }
 
 bool xmlChangeLink( wxXmlNode* node, const wxString& href )
 {
-    if ( node->GetName() != "a" ) {
+    if ( node->GetAtom() != wxXML_ATOM_A ) {
         return false;
     }
-    for ( wxXmlAttribute* attr = node->GetAttributes(); attr; attr->GetNext() ) {
-        if ( attr->GetName() == "href" ) {
-            attr->SetValue( href );
-            return true;
-        }
+    wxXmlAttribute* attr = node->FindAttribute( wxXML_ATOM_HREF );
+    if ( attr ) {
+        attr->SetValue( href );
+        node->SetModified();
+        return true;
     }
     return false;
 }
 
-wxString xmlCreateHref( recEntity entity, idt id )
+bool xmlAppendHref( wxString& buf, recEntity entity, idt id )
 {
-    wxString href;
     if ( id == 0 ) {
-        return href;
+        return false;
     }
     switch ( entity )
     {
     case recENT_Persona:
-        href = "tfpr:Pa";
+        buf << "tfpr:Pa";
         break;
     case recENT_Eventa:
-        href = "tfpr:Ea";
+        buf << "tfpr:Ea";
         break;
     case recENT_Name:
-        href = "tfpi:N";
+        buf << "tfpi:N";
         break;
     case recENT_Date:
-        href = "tfpi:D";
+        buf << "tfpi:D";
         break;
     case recENT_Place:
-        href = "tfpi:P";
+        buf << "tfpi:P";
         break;
     case recENT_Citation:
-        href = "tfpi:Ci";
+        buf << "tfpi:Ci";
         break;
     default:
-        return href;
+        return false;
+    }
+    // The same digits as recGetStr( id ), without a temporary string.
+    char digits[24];
+    char* p = digits + sizeof( digits );
+    unsigned long long num = id < 0 ? 0ULL - id : id;
+    do {
+        *--p = '0' + num % 10;
+        num /= 10;
+    } while ( num );
+    if ( id < 0 ) {
+        *--p = '-';
+    }
+    buf.append( p, digits + sizeof( digits ) - p );
+    return true;
+}
+
+void xmlLinkEdits::create( wxXmlNode* node, const wxString& href )
+{
+    if( !node ) return;
+    Edit edit = { EDIT_Wrap, node, 0, 0, m_hrefs.length(), href.length() };
+    m_hrefs << href;
+    m_edits.push_back( edit );
+}
+
+void xmlLinkEdits::create( wxXmlNode* node, recEntity entity, idt id )
+{
+    if( !node ) return;
+    Edit edit = { EDIT_Wrap, node, 0, 0, m_hrefs.length(), 0 };
+    if( xmlAppendHref( m_hrefs, entity, id ) ) {
+        edit.len = m_hrefs.length() - edit.href;
+        m_edits.push_back( edit );
     }
-    return href + recGetStr( id );
 }
 
-wxXmlNode* xmlCreateLink( wxXmlNode* node, recEntity entity, idt id )
+void xmlLinkEdits::create( wxXmlNode* node, int beg, int end, recEntity entity, idt id )
 {
-    wxString href = xmlCreateHref( entity, id );
-    if ( href.empty() ) {
-        return node;
+    if( node && node->GetType() != wxXML_TEXT_NODE ) {
+        node = xmlGetFirstText( node );
+    }
+    if( !node ) return;
+    Edit edit = { EDIT_Range, node, beg, end, m_hrefs.length(), 0 };
+    if( xmlAppendHref( m_hrefs, entity, id ) ) {
+        edit.len = m_hrefs.length() - edit.href;
+        m_edits.push_back( edit );
     }
-    return xmlCreateLink( node, href );
 }
 
-wxXmlNode* xmlCreateLink( wxXmlNode* node, int beg, int end, recEntity entity, idt id )
+void xmlLinkEdits::change( wxXmlNode* node, const wxString& href )
+{
+    if( !node ) return;
+    Edit edit = { EDIT_Change, node, 0, 0, m_hrefs.length(), href.length() };
+    m_hrefs << href;
+    m_edits.push_back( edit );
+}
+
+void xmlLinkEdits::change( wxXmlNode* node, recEntity entity, idt id )
 {
-    wxString href = xmlCreateHref( entity, id );
-    if ( href.empty() ) {
-        return node;
+    if( !node ) return;
+    Edit edit = { EDIT_Change, node, 0, 0, m_hrefs.length(), 0 };
+    if( xmlAppendHref( m_hrefs, entity, id ) ) {
+        edit.len = m_hrefs.length() - edit.href;
+        m_edits.push_back( edit );
     }
-    return xmlCreateLink( node, beg, end, href );
 }
 
-bool xmlChangeLink( wxXmlNode* node, recEntity entity, idt id )
+void xmlLinkEdits::replace( wxXmlNode* node, const wxString& href )
 {
-    wxString href = xmlCreateHref( entity, id );
-    if ( href.empty() ) {
-        return false;
+    if( !node ) return;
+    Edit edit = { EDIT_Replace, node, 0, 0, m_hrefs.length(), href.length() };
+    m_hrefs << href;
+    m_edits.push_back( edit );
+}
+
+void xmlLinkEdits::split_text( const Edit* first, const Edit* last, size_t* dropped )
+{
+    wxXmlNode* text = first->node;
+    wxXmlNode* parent = text->GetParent();
+    const wxString& str = text->GetContent();
+    size_t length = str.length();
+    std::vector<wxXmlNode*> pieces;
+    size_t pos = 0;
+    for( const Edit* edit = first ; edit != last ; edit++ ) {
+        size_t beg = edit->beg;
+        size_t end = ( edit->end < 0 || (size_t) edit->end > length ) ? length : edit->end;
+        if( beg >= end ) continue;
+        if( beg < pos ) {
+            ++*dropped;
+            continue;
+        }
+        if( beg > pos ) {
+            pieces.push_back( new wxXmlNode( wxXML_TEXT_NODE, "text", str.substr( pos, beg - pos ) ) );
+        }
+        wxXmlNode* link = new wxXmlNode( wxXML_ELEMENT_NODE, "a" );
+        link->AddAttribute( "href", m_hrefs.substr( edit->href, edit->len ) );
+        link->AddChild( new wxXmlNode( wxXML_TEXT_NODE, "text", str.substr( beg, end - beg ) ) );
+        pieces.push_back( link );
+        pos = end;
+    }
+    if( pieces.empty() || !parent ) {
+        for( size_t i = 0 ; i < pieces.size() ; i++ ) {
+            delete pieces[i];
+        }
+        return;
+    }
+    if( pos < length ) {
+        pieces.push_back( new wxXmlNode( wxXML_TEXT_NODE, "text", str.substr( pos ) ) );
+    }
+    for( size_t i = 0 ; i < pieces.size() ; i++ ) {
+        parent->InsertChild( pieces[i], text );
+    }
+    parent->RemoveChild( text );
+    delete text;
+}
+
+size_t xmlLinkEdits::apply()
+{
+    // Text is split first, so that wrapping an element takes in any links
+    // made inside it. Edits of one node end up next to each other.
+    std::stable_sort( m_edits.begin(), m_edits.end(), []( const Edit& a, const Edit& b ) {
+        if( a.kind != b.kind ) return a.kind < b.kind;
+        if( a.node != b.node ) return std::less<wxXmlNode*>()( a.node, b.node );
+        return a.beg < b.beg;
+    } );
+    size_t dropped = 0;
+    for( size_t i = 0 ; i < m_edits.size() ; ) {
+        const Edit& edit = m_edits[i];
+        size_t next = i + 1;
+        while( next < m_edits.size() && m_edits[next].kind == edit.kind && m_edits[next].node == edit.node ) {
+            next++;
+        }
+        if( edit.kind == EDIT_Range ) {
+            split_text( &m_edits[i], &m_edits[0] + next, &dropped );
+        } else {
+            // Only one link can be made from, or put on, an element.
+            dropped += next - i - 1;
+            wxString href = m_hrefs.substr( edit.href, edit.len );
+            switch( edit.kind )
+            {
+            case EDIT_Wrap:
+                xmlCreateLink( edit.node, href );
+                break;
+            case EDIT_Change:
+                xmlChangeLink( edit.node, href );
+                break;
+            case EDIT_Replace:
+                if( edit.node->GetAtom() != wxXML_ATOM_A ) {
+                    edit.node->SetName( "a" );
+                }
+                // The element is usually marked with a single id attribute,
+                // which is reused.
+                if( edit.node->GetAttributeCount() == 1 ) {
+                    wxXmlAttribute& attr = edit.node->GetAttributeAt( 0 );
+                    attr.SetName( "href" );
+                    attr.SetValue( href );
+                    edit.node->SetModified();
+                } else {
+                    edit.node->ClearAttributes();
+                    edit.node->AddAttribute( "href", href );
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        i = next;
     }
-    return xmlChangeLink( node, href );
+    m_edits.clear();
+    m_hrefs.clear();
+    return dropped;
 }
 
 // End of nkRefDocuments.cpp file 
@@ -32,8 +32,23 @@
 #include "wx/strconv.h"
 #include "wx/scopedptr.h"
 #include "wx/versioninfo.h"
+#include "wx/file.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+#ifdef __UNIX__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 #include "../src/expat/expat/lib/expat.h" // from Expat
+#include "xml2simd.h"
 
 // DLL options compatibility check:
 WX_CHECK_BUILD_OPTIONS("wxXML")
@@ -46,67 +61,210 @@ IMPLEMENT_CLASS(wxXmlDocument, wxObject)
 static bool wxIsWhiteOnly(const wxString& buf);
 
 
+//-----------------------------------------------------------------------------
+//  wxXmlAtom
+//-----------------------------------------------------------------------------
+
+namespace
+{
+
+// Indexed by wxXmlAtom.
+constexpr const char *s_atomNames[] =
+{
+    "",
+    "a",
+    "alt",
+    "b",
+    "body",
+    "br",
+    "center",
+    "class",
+    "colspan",
+    "div",
+    "entries",
+    "entry",
+    "file",
+    "galleries",
+    "gallery",
+    "h1",
+    "h2",
+    "h3",
+    "head",
+    "href",
+    "html",
+    "i",
+    "id",
+    "img",
+    "li",
+    "link",
+    "meta",
+    "name",
+    "number",
+    "p",
+    "pre",
+    "rowspan",
+    "span",
+    "src",
+    "style",
+    "table",
+    "tbody",
+    "td",
+    "th",
+    "title",
+    "tr",
+    "ul"
+};
+
+static_assert( sizeof(s_atomNames) / sizeof(s_atomNames[0]) == wxXML_ATOM_MAX,
+               "s_atomNames is out of step with wxXmlAtom" );
+
+// The hash only looks at the length and the first, second and last
+// characters, the multipliers were chosen so that every name in s_atomNames
+// gets a slot of its own. The static_assert below checks that still holds if
+// the list is changed.
+const size_t ATOM_SLOTS = 128;
+
+template <typename CharType>
+constexpr size_t AtomHash(const CharType *name, size_t len)
+{
+    return ( size_t(name[0])
+           + 7 * (len > 1 ? size_t(name[1]) : 0)
+           + 10 * size_t(name[len - 1])
+           + len ) & (ATOM_SLOTS - 1);
+}
+
+constexpr size_t AtomNameLen(const char *name)
+{
+    return *name ? 1 + AtomNameLen(name + 1) : 0;
+}
+
+struct AtomTable
+{
+    unsigned char slot[ATOM_SLOTS];
+    bool ok;
+};
+
+constexpr AtomTable MakeAtomTable()
+{
+    AtomTable table = {};
+    table.ok = true;
+    for ( int atom = 1; atom < wxXML_ATOM_MAX; atom++ )
+    {
+        const char *name = s_atomNames[atom];
+        size_t hash = AtomHash(name, AtomNameLen(name));
+        if ( table.slot[hash] != 0 )
+            table.ok = false;
+        table.slot[hash] = (unsigned char)atom;
+    }
+    return table;
+}
+
+constexpr AtomTable s_atomTable = MakeAtomTable();
+
+static_assert( s_atomTable.ok, "wxXmlAtom names collide, choose new multipliers" );
+
+template <typename CharType>
+wxXmlAtom LookupAtom(const CharType *name, size_t len)
+{
+    if ( len == 0 )
+        return wxXML_ATOM_UNKNOWN;
+
+    int atom = s_atomTable.slot[AtomHash(name, len)];
+    const char *str = s_atomNames[atom];
+    for ( size_t i = 0; i < len; i++ )
+    {
+        // The names are ASCII, the terminating NUL stops any longer name.
+        if ( (unsigned)name[i] != (unsigned char)str[i] || !str[i] )
+            return wxXML_ATOM_UNKNOWN;
+    }
+    return str[len] ? wxXML_ATOM_UNKNOWN : (wxXmlAtom)atom;
+}
+
+} // anonymous namespace
+
+wxXmlAtom wxXmlGetAtom(const char *name, size_t len)
+{
+    return LookupAtom(name, len);
+}
+
+wxXmlAtom wxXmlGetAtom(const wxString& name)
+{
+    return LookupAtom(name.wx_str(), name.length());
+}
+
+const char *wxXmlGetAtomName(wxXmlAtom atom)
+{
+    wxCHECK_MSG( atom >= 0 && atom < wxXML_ATOM_MAX, "", "invalid atom" );
+    return s_atomNames[atom];
+}
+
+
 //-----------------------------------------------------------------------------
 //  wxXmlNode
 //-----------------------------------------------------------------------------
 
 wxXmlNode::wxXmlNode(wxXmlNode *parent,wxXmlNodeType type,
                      const wxString& name, const wxString& content,
-                     wxXmlAttribute *attrs, wxXmlNode *next, int lineNo)
-    : m_type(type), m_name(name), m_content(content),
+                     const wxXmlAttributeList& attrs, wxXmlNode *next, int lineNo)
+    : m_type(type), m_name(name), m_atom(wxXmlGetAtom(name)),
+      m_content(content),
       m_attrs(attrs), m_parent(parent),
-      m_children(NULL), m_next(next),
+      m_children(NULL), m_lastChild(NULL), m_next(next), m_prev(NULL),
       m_lineNo(lineNo),
-      m_noConversion(false)
+      m_noConversion(false), m_lazy(false),
+      m_srcBegin(0), m_srcEnd(0), m_cachedText(NULL)
 {
     if (m_parent)
     {
-        if (m_parent->m_children)
+        if (m_parent->GetChildren())
         {
             m_next = m_parent->m_children;
             m_parent->m_children = this;
         }
         else
+        {
+            m_next = NULL;
             m_parent->m_children = this;
+            m_parent->m_lastChild = this;
+        }
     }
+    if (m_next)
+        m_next->m_prev = this;
 }
 
 wxXmlNode::wxXmlNode(wxXmlNodeType type, const wxString& name,
                      const wxString& content,
                      int lineNo)
-    : m_type(type), m_name(name), m_content(content),
-      m_attrs(NULL), m_parent(NULL),
-      m_children(NULL), m_next(NULL),
-      m_lineNo(lineNo), m_noConversion(false)
+    : m_type(type), m_name(name), m_atom(wxXmlGetAtom(name)),
+      m_content(content),
+      m_parent(NULL),
+      m_children(NULL), m_lastChild(NULL), m_next(NULL), m_prev(NULL),
+      m_lineNo(lineNo), m_noConversion(false), m_lazy(false),
+      m_srcBegin(0), m_srcEnd(0), m_cachedText(NULL)
 {}
 
 wxXmlNode::wxXmlNode(const wxXmlNode& node)
 {
     m_next = NULL;
+    m_prev = NULL;
     m_parent = NULL;
+    m_cachedText = NULL;
     DoCopy(node);
 }
 
 wxXmlNode::~wxXmlNode()
 {
+    delete m_cachedText;
     wxXmlNode *c, *c2;
     for (c = m_children; c; c = c2)
     {
         c2 = c->m_next;
         delete c;
     }
-
-    wxXmlAttribute *p, *p2;
-    for (p = m_attrs; p; p = p2)
-    {
-        p2 = p->GetNext();
-        delete p;
-    }
 }
 
 wxXmlNode& wxXmlNode::operator=(const wxXmlNode& node)
 {
-    wxDELETE(m_attrs);
     wxDELETE(m_children);
     DoCopy(node);
     return *this;
@@ -116,80 +274,120 @@ void wxXmlNode::DoCopy(const wxXmlNode& node)
 {
     m_type = node.m_type;
     m_name = node.m_name;
+    m_atom = node.m_atom;
     m_content = node.m_content;
     m_lineNo = node.m_lineNo;
     m_noConversion = node.m_noConversion;
     m_children = NULL;
+    m_lastChild = NULL;
+    m_lazy = false;
+    // the copy doesn't belong to the buffer the range refers to
+    m_srcBegin = m_srcEnd = 0;
+    wxDELETE(m_cachedText);
 
-    wxXmlNode *n = node.m_children;
+    wxXmlNode *n = node.GetChildren();
     while (n)
     {
         AddChild(new wxXmlNode(*n));
         n = n->GetNext();
     }
 
-    m_attrs = NULL;
-    wxXmlAttribute *p = node.m_attrs;
-    while (p)
+    m_attrs = node.m_attrs;
+}
+
+const wxXmlAttribute *wxXmlNode::FindAttribute(wxXmlAtom attr) const
+{
+    for (wxXmlAttributeList::const_iterator i = m_attrs.begin(); i != m_attrs.end(); ++i)
     {
-       AddAttribute(p->GetName(), p->GetValue());
-       p = p->GetNext();
+        if (i->GetAtom() == attr)
+            return i;
     }
+    return NULL;
 }
 
-bool wxXmlNode::HasAttribute(const wxString& attrName) const
+wxXmlAttribute *wxXmlNode::FindAttribute(wxXmlAtom attr)
+{
+    for (wxXmlAttributeList::iterator i = m_attrs.begin(); i != m_attrs.end(); ++i)
+    {
+        if (i->GetAtom() == attr)
+            return i;
+    }
+    return NULL;
+}
+
+const wxXmlAttribute *wxXmlNode::FindAttribute(const wxString& attrName) const
 {
-    wxXmlAttribute *attr = GetAttributes();
+    wxXmlAtom atom = wxXmlGetAtom(attrName);
+    if (atom != wxXML_ATOM_UNKNOWN)
+        return FindAttribute(atom);
 
-    while (attr)
+    for (wxXmlAttributeList::const_iterator i = m_attrs.begin(); i != m_attrs.end(); ++i)
     {
-        if (attr->GetName() == attrName) return true;
-        attr = attr->GetNext();
+        if (i->GetAtom() == wxXML_ATOM_UNKNOWN && i->GetName() == attrName)
+            return i;
     }
+    return NULL;
+}
 
-    return false;
+bool wxXmlNode::HasAttribute(const wxString& attrName) const
+{
+    return FindAttribute(attrName) != NULL;
 }
 
 bool wxXmlNode::GetAttribute(const wxString& attrName, wxString *value) const
 {
     wxCHECK_MSG( value, false, "value argument must not be NULL" );
 
-    wxXmlAttribute *attr = GetAttributes();
-
-    while (attr)
-    {
-        if (attr->GetName() == attrName)
-        {
-            *value = attr->GetValue();
-            return true;
-        }
-        attr = attr->GetNext();
-    }
+    const wxXmlAttribute *attr = FindAttribute(attrName);
+    if (!attr)
+        return false;
 
-    return false;
+    *value = attr->GetValue();
+    return true;
 }
 
 wxString wxXmlNode::GetAttribute(const wxString& attrName, const wxString& defaultVal) const
 {
-    wxString tmp;
-    if (GetAttribute(attrName, &tmp))
-        return tmp;
+    const wxXmlAttribute *attr = FindAttribute(attrName);
+    return attr ? attr->GetValue() : defaultVal;
+}
 
-    return defaultVal;
+bool wxXmlNode::HasAttribute(wxXmlAtom attr) const
+{
+    return FindAttribute(attr) != NULL;
+}
+
+bool wxXmlNode::GetAttribute(wxXmlAtom attr, wxString *value) const
+{
+    wxCHECK_MSG( value, false, "value argument must not be NULL" );
+
+    const wxXmlAttribute *a = FindAttribute(attr);
+    if (!a)
+        return false;
+
+    *value = a->GetValue();
+    return true;
+}
+
+wxString wxXmlNode::GetAttribute(wxXmlAtom attr, const wxString& defaultVal) const
+{
+    const wxXmlAttribute *a = FindAttribute(attr);
+    return a ? a->GetValue() : defaultVal;
 }
 
 void wxXmlNode::AddChild(wxXmlNode *child)
 {
-    if (m_children == NULL)
+    if (m_lazy)
+        ParseLazyChildren();
+    if (m_lastChild == NULL)
         m_children = child;
     else
-    {
-        wxXmlNode *ch = m_children;
-        while (ch->m_next) ch = ch->m_next;
-        ch->m_next = child;
-    }
+        m_lastChild->m_next = child;
+    child->m_prev = m_lastChild;
     child->m_next = NULL;
     child->m_parent = this;
+    m_lastChild = child;
+    SetModified();
 }
 
 // inserts a new node in front of 'followingNode'
@@ -202,32 +400,33 @@ bool wxXmlNode::InsertChild(wxXmlNode *child, wxXmlNode *followingNode)
                  false,
                  "wxXmlNode::InsertChild - followingNode has incorrect parent" );
 
+    if (m_lazy)
+        ParseLazyChildren();
+
     // this is for backward compatibility, NULL was allowed here thanks to
     // the confusion about followingNode's meaning
     if ( followingNode == NULL )
         followingNode = m_children;
 
-    if ( m_children == followingNode )
+    if ( followingNode == NULL )
     {
-        child->m_next = m_children;
-        m_children = child;
+        // no children at all
+        m_children = m_lastChild = child;
+        child->m_prev = NULL;
     }
     else
     {
-        wxXmlNode *ch = m_children;
-        while ( ch && ch->m_next != followingNode )
-            ch = ch->m_next;
-        if ( !ch )
-        {
-            wxFAIL_MSG( "followingNode has this node as parent, but couldn't be found among children" );
-            return false;
-        }
-
+        child->m_prev = followingNode->m_prev;
         child->m_next = followingNode;
-        ch->m_next = child;
+        if ( followingNode->m_prev )
+            followingNode->m_prev->m_next = child;
+        else
+            m_children = child;
+        followingNode->m_prev = child;
     }
 
     child->m_parent = this;
+    SetModified();
     return true;
 }
 
@@ -240,9 +439,17 @@ bool wxXmlNode::InsertChildAfter(wxXmlNode *child, wxXmlNode *precedingNode)
     wxCHECK_MSG( precedingNode == NULL || precedingNode->m_parent == this, false,
                  "precedingNode has wrong parent" );
 
+    if (m_lazy)
+        ParseLazyChildren();
+
     if ( precedingNode )
     {
         child->m_next = precedingNode->m_next;
+        child->m_prev = precedingNode;
+        if ( precedingNode->m_next )
+            precedingNode->m_next->m_prev = child;
+        else
+            m_lastChild = child;
         precedingNode->m_next = child;
     }
     else // precedingNode == NULL
@@ -250,108 +457,131 @@ bool wxXmlNode::InsertChildAfter(wxXmlNode *child, wxXmlNode *precedingNode)
         wxCHECK_MSG( m_children == NULL, false,
                      "NULL precedingNode only makes sense when there are no children" );
 
-        child->m_next = m_children;
-        m_children = child;
+        child->m_next = NULL;
+        child->m_prev = NULL;
+        m_children = m_lastChild = child;
     }
 
     child->m_parent = this;
+    SetModified();
     return true;
 }
 
 bool wxXmlNode::RemoveChild(wxXmlNode *child)
 {
-    if (m_children == NULL)
+    if (child == NULL || child->m_parent != this)
         return false;
-    else if (m_children == child)
-    {
+
+    // done first, while a lazy element can still reach the buffer
+    child->ClearSourceRanges();
+    if (child->m_prev)
+        child->m_prev->m_next = child->m_next;
+    else
         m_children = child->m_next;
-        child->m_parent = NULL;
-        child->m_next = NULL;
-        return true;
-    }
+    if (child->m_next)
+        child->m_next->m_prev = child->m_prev;
     else
-    {
-        wxXmlNode *ch = m_children;
-        while (ch->m_next)
-        {
-            if (ch->m_next == child)
-            {
-                ch->m_next = child->m_next;
-                child->m_parent = NULL;
-                child->m_next = NULL;
-                return true;
-            }
-            ch = ch->m_next;
-        }
-        return false;
-    }
+        m_lastChild = child->m_prev;
+
+    child->m_parent = NULL;
+    child->m_next = NULL;
+    child->m_prev = NULL;
+    SetModified();
+    return true;
 }
 
-void wxXmlNode::AddAttribute(const wxString& name, const wxString& value)
+void wxXmlNode::SetNext(wxXmlNode *next)
 {
-    AddProperty(name, value);
+    m_next = next;
+    if (next)
+        next->m_prev = this;
+    else if (m_parent)
+        m_parent->m_lastChild = this;
+    if (m_parent)
+        m_parent->SetModified();
 }
 
-void wxXmlNode::AddAttribute(wxXmlAttribute *attr)
+void wxXmlNode::SetChildren(wxXmlNode *child)
 {
-    AddProperty(attr);
+    m_lazy = false; // the unparsed children are replaced
+    m_children = child;
+    m_lastChild = child;
+    if (child)
+    {
+        child->m_prev = NULL;
+        while (m_lastChild->m_next)
+            m_lastChild = m_lastChild->m_next;
+    }
+    SetModified();
 }
 
-bool wxXmlNode::DeleteAttribute(const wxString& name)
+void wxXmlNode::AddAttribute(const wxString& name, const wxString& value)
 {
-    return DeleteProperty(name);
+    m_attrs.push_back(wxXmlAttribute(name, value));
+    SetModified();
 }
 
-void wxXmlNode::AddProperty(const wxString& name, const wxString& value)
+void wxXmlNode::SetAttribute(const wxString& name, const wxString& value)
 {
-    AddProperty(new wxXmlAttribute(name, value, NULL));
+    for (wxXmlAttributeList::iterator i = m_attrs.begin(); i != m_attrs.end(); ++i)
+    {
+        if (i->GetName() == name)
+        {
+            i->SetValue(value);
+            SetModified();
+            return;
+        }
+    }
+    AddAttribute(name, value);
 }
 
-void wxXmlNode::AddProperty(wxXmlAttribute *attr)
+bool wxXmlNode::DeleteAttribute(const wxString& name)
 {
-    if (m_attrs == NULL)
-        m_attrs = attr;
-    else
+    for (wxXmlAttributeList::iterator i = m_attrs.begin(); i != m_attrs.end(); ++i)
     {
-        wxXmlAttribute *p = m_attrs;
-        while (p->GetNext()) p = p->GetNext();
-        p->SetNext(attr);
+        if (i->GetName() == name)
+        {
+            m_attrs.erase(i);
+            SetModified();
+            return true;
+        }
     }
+    return false;
 }
 
-bool wxXmlNode::DeleteProperty(const wxString& name)
+void wxXmlNode::SetModified()
 {
-    wxXmlAttribute *attr;
-
-    if (m_attrs == NULL)
-        return false;
-
-    else if (m_attrs->GetName() == name)
+    // The children must be parsed while the range is still known.
+    if (m_lazy)
+        ParseLazyChildren();
+    // Only elements have a range, other nodes are written by their parent.
+    // Once an element without one is reached, the ones above it have none.
+    wxXmlNode *node = m_type == wxXML_ELEMENT_NODE ? this : m_parent;
+    while (node && node->HasSourceRange())
     {
-        attr = m_attrs;
-        m_attrs = attr->GetNext();
-        attr->SetNext(NULL);
-        delete attr;
-        return true;
+        node->m_srcBegin = node->m_srcEnd = 0;
+        node = node->m_parent;
     }
+    // Any element above may have text cached, whether or not it has a range.
+    for (node = this; node; node = node->m_parent)
+        wxDELETE(node->m_cachedText);
+}
 
+void wxXmlNode::SetCachedText(const wxString& text) const
+{
+    if (m_cachedText)
+        *m_cachedText = text;
     else
-    {
-        wxXmlAttribute *p = m_attrs;
-        while (p->GetNext())
-        {
-            if (p->GetNext()->GetName() == name)
-            {
-                attr = p->GetNext();
-                p->SetNext(attr->GetNext());
-                attr->SetNext(NULL);
-                delete attr;
-                return true;
-            }
-            p = p->GetNext();
-        }
-        return false;
-    }
+        m_cachedText = new wxString(text);
+}
+
+void wxXmlNode::ClearSourceRanges()
+{
+    if (m_lazy)
+        ParseLazyChildren();
+    m_srcBegin = m_srcEnd = 0;
+    for (wxXmlNode *n = m_children; n; n = n->m_next)
+        n->ClearSourceRanges();
 }
 
 wxString wxXmlNode::GetNodeContent() const
@@ -392,12 +622,114 @@ bool wxXmlNode::IsWhitespaceOnly_() const
 
 
 
+//-----------------------------------------------------------------------------
+//  input buffers
+//-----------------------------------------------------------------------------
+
+namespace
+{
+
+// Reads everything left in the stream into buf, in as few reads as the
+// stream allows.
+void ReadWholeStream(wxInputStream& stream, std::string& buf)
+{
+    const size_t CHUNKSIZE = 64 * 1024;
+    buf.clear();
+
+    wxFileOffset size = stream.GetLength();
+    if ( size != wxInvalidOffset && size > 0 )
+        buf.reserve((size_t)size + 1);
+
+    for ( ;; )
+    {
+        size_t used = buf.size();
+        size_t avail = buf.capacity() > used ? buf.capacity() - used : 0;
+        if ( avail < CHUNKSIZE )
+            avail = CHUNKSIZE;
+        buf.resize(used + avail);
+        size_t len = stream.Read(&buf[used], avail).LastRead();
+        buf.resize(used + len);
+        if ( len == 0 )
+            break;
+    }
+}
+
+} // anonymous namespace
+
+// The contents of a file as one block of memory, mapped where the platform
+// allows it, otherwise read in a single call.
+class wxXmlInputBuffer
+{
+public:
+    wxXmlInputBuffer() : m_data(NULL), m_len(0), m_mapped(false) {}
+    ~wxXmlInputBuffer()
+    {
+#ifdef __UNIX__
+        if ( m_mapped )
+            munmap((void*)m_data, m_len);
+#endif
+    }
+
+    bool Open(const wxString& filename)
+    {
+#ifdef __UNIX__
+        int fd = open(filename.fn_str(), O_RDONLY);
+        if ( fd < 0 )
+            return false;
+        struct stat st;
+        if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 )
+        {
+            void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( addr != MAP_FAILED )
+            {
+#ifdef MADV_SEQUENTIAL
+                madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+                close(fd);
+                m_data = (const char*)addr;
+                m_len = (size_t)st.st_size;
+                m_mapped = true;
+                return true;
+            }
+        }
+        close(fd);
+#endif // __UNIX__
+
+        wxFile file;
+        if ( !file.Open(filename) )
+            return false;
+        wxFileOffset len = file.Length();
+        if ( len == wxInvalidOffset )
+            return false;
+        m_buffer.resize((size_t)len);
+        if ( len > 0 && file.Read(&m_buffer[0], (size_t)len) != (ssize_t)len )
+            return false;
+        m_data = m_buffer.data();
+        m_len = m_buffer.size();
+        return true;
+    }
+
+    const char *GetData() const { return m_data; }
+    size_t GetLength() const { return m_len; }
+
+private:
+    const char *m_data;
+    size_t      m_len;
+    bool        m_mapped;
+    std::string m_buffer;
+
+    wxDECLARE_NO_COPY_CLASS(wxXmlInputBuffer);
+};
+
 //-----------------------------------------------------------------------------
 //  wxXmlDocument
 //-----------------------------------------------------------------------------
 
+wxXmlParserKind wxXmlDocument::ms_parser = wxXML_PARSER_EXPAT;
+
 wxXmlDocument::wxXmlDocument()
-    : m_version(wxS("1.0")), m_fileEncoding(wxS("UTF-8")), m_docNode(NULL)
+    : m_version(wxS("1.0")), m_fileEncoding(wxS("UTF-8")), m_docNode(NULL),
+      m_lazyFilter(NULL)
 {
 #if !wxUSE_UNICODE
     m_encoding = wxS("UTF-8");
@@ -405,7 +737,7 @@ wxXmlDocument::wxXmlDocument()
 }
 
 wxXmlDocument::wxXmlDocument(const wxString& filename, const wxString& encoding)
-              :wxObject(), m_docNode(NULL)
+              :wxObject(), m_docNode(NULL), m_lazyFilter(NULL)
 {
     if ( !Load(filename, encoding) )
     {
@@ -414,7 +746,7 @@ wxXmlDocument::wxXmlDocument(const wxString& filename, const wxString& encoding)
 }
 
 wxXmlDocument::wxXmlDocument(wxInputStream& stream, const wxString& encoding)
-              :wxObject(), m_docNode(NULL)
+              :wxObject(), m_docNode(NULL), m_lazyFilter(NULL)
 {
     if ( !Load(stream, encoding) )
     {
@@ -442,6 +774,8 @@ void wxXmlDocument::DoCopy(const wxXmlDocument& doc)
     m_encoding = doc.m_encoding;
 #endif
     m_fileEncoding = doc.m_fileEncoding;
+    m_lazyFilter = doc.m_lazyFilter;
+    m_anchors.clear(); // they point into the other tree
 
     if (doc.m_docNode)
         m_docNode = new wxXmlNode(*doc.m_docNode);
@@ -451,10 +785,10 @@ void wxXmlDocument::DoCopy(const wxXmlDocument& doc)
 
 bool wxXmlDocument::Load(const wxString& filename, const wxString& encoding, int flags)
 {
-    wxFileInputStream stream(filename);
-    if (!stream.IsOk())
+    wxXmlInputBuffer input;
+    if (!input.Open(filename))
         return false;
-    return Load(stream, encoding, flags);
+    return Load(input.GetData(), input.GetLength(), encoding, flags);
 }
 
 bool wxXmlDocument::Save(const wxString& filename, int indentstep, int flags) const
@@ -483,23 +817,10 @@ wxXmlNode *wxXmlDocument::DetachRoot()
     if (node)
     {
         node = m_docNode->GetChildren();
-        wxXmlNode *prev = NULL;
         while (node != NULL && node->GetType() != wxXML_ELEMENT_NODE)
-        {
-            prev = node;
             node = node->GetNext();
-        }
         if (node)
-        {
-            if (node == m_docNode->GetChildren())
-                m_docNode->SetChildren(node->GetNext());
-
-            if (prev)
-                prev->SetNext(node->GetNext());
-
-            node->SetParent(NULL);
-            node->SetNext(NULL);
-        }
+            m_docNode->RemoveChild(node);
     }
     return node;
 }
@@ -512,33 +833,24 @@ void wxXmlDocument::SetRoot(wxXmlNode *root)
                       "Can only set an element type node as root" );
     }
 
-    wxXmlNode *node = m_docNode;
+    if (!m_docNode)
+        m_docNode = new wxXmlNode(wxXML_DOCUMENT_NODE, wxEmptyString);
+
+    wxXmlNode *node = m_docNode->GetChildren();
+    while (node != NULL && node->GetType() != wxXML_ELEMENT_NODE)
+        node = node->GetNext();
     if (node)
     {
-        node = m_docNode->GetChildren();
-        wxXmlNode *prev = NULL;
-        while (node != NULL && node->GetType() != wxXML_ELEMENT_NODE)
-        {
-            prev = node;
-            node = node->GetNext();
-        }
-        if (node && root)
-        {
-            root->SetNext( node->GetNext() );
-            wxDELETE(node);
-        }
-        if (prev)
-            prev->SetNext(root);
-        else
-            m_docNode->SetChildren(root);
+        // the new root takes the old one's place among the prolog nodes
+        if (root)
+            m_docNode->InsertChild(root, node);
+        m_docNode->RemoveChild(node);
+        delete node;
     }
-    else
+    else if (root)
     {
-        m_docNode = new wxXmlNode(wxXML_DOCUMENT_NODE, wxEmptyString);
-        m_docNode->SetChildren(root);
+        m_docNode->AddChild(root);
     }
-    if (root)
-        root->SetParent(m_docNode);
 }
 
 void wxXmlDocument::AppendToProlog(wxXmlNode *node)
@@ -574,7 +886,20 @@ static wxString CharToString(wxMBConv *conv,
 #endif // !wxUSE_UNICODE
 
     wxUnusedVar(conv);
+#if wxUSE_UNICODE_WCHAR
+    if ( len == wxString::npos )
+        len = strlen(s);
+    wxString str;
+    {
+        // a UTF-8 string never has fewer bytes than wide characters
+        wxStringBufferLength buf(str, len);
+        wxChar *out = buf;
+        buf.SetLength(wxXmlSimd::Utf8ToWide(s, s + len, out) - out);
+    }
+    return str;
+#else
     return wxString::FromUTF8Unchecked(s, len);
+#endif
 }
 
 // returns true if the given string contains only whitespaces
@@ -589,27 +914,120 @@ bool wxIsWhiteOnly(const wxString& buf)
     return true;
 }
 
+// same as above for the UTF-8 text collected by the parser
+static bool wxIsWhiteOnly(const std::string& buf)
+{
+    for ( std::string::const_iterator i = buf.begin(); i != buf.end(); ++i )
+    {
+        char c = *i;
+        if ( c != ' ' && c != '\t' && c != '\n' && c != '\r' )
+            return false;
+    }
+    return true;
+}
 
 struct wxXmlParsingContext
 {
     wxXmlParsingContext()
-        : conv(NULL),
+        : parser(NULL),
+          conv(NULL),
           node(NULL),
           lastChild(NULL),
           lastAsText(NULL),
-          removeWhiteOnlyNodes(false)
+          textLineNo(-1),
+          removeWhiteOnlyNodes(false),
+          inProlog(true),
+          keepSource(false),
+          startTagEnd(0),
+          srcBase(0),
+          lineBase(0),
+          lazyFilter(NULL),
+          lazyDepth(0),
+          lazyCount(0),
+          anchors(NULL),
+          tokSource(NULL),
+          tokStart(NULL),
+          tokLen(0),
+          lineScanned(NULL),
+          lineNo(1)
     {}
 
     XML_Parser parser;
     wxMBConv  *conv;
     wxXmlNode *node;                    // the node being parsed
     wxXmlNode *lastChild;               // the last child of "node"
-    wxXmlNode *lastAsText;              // the last _text_ child of "node"
+    wxXmlNode *lastAsText;              // the CDATA node being parsed
+    std::string text;                   // pending character data, in UTF-8
+    int        textLineNo;              // line where "text" started
     wxString   encoding;
     wxString   version;
     bool       removeWhiteOnlyNodes;
+    bool       inProlog;                // before the root element
+    bool       keepSource;              // record the elements' byte ranges
+    size_t     startTagEnd;             // end of the last start tag
+    size_t     srcBase;                 // offset of the input in the source
+    int        lineBase;                // lines before the input
+    wxXmlLazyFilter lazyFilter;         // elements to skip, or NULL
+    int        lazyDepth;               // depth inside a skipped element
+    size_t     lazyCount;               // elements left unparsed
+    std::vector<wxXmlNode*> *anchors;   // <a href> elements found, or NULL
+
+    // Links child in after lastChild. Nothing above a node being loaded is
+    // complete yet, so there is no range or cached text for SetModified()
+    // to drop, and the walk to the root that InsertChildAfter() makes for
+    // it is skipped.
+    void AddChild(wxXmlNode *child)
+    {
+        child->m_parent = node;
+        child->m_prev = lastChild;
+        if (lastChild)
+            lastChild->m_next = child;
+        else
+            node->m_children = child;
+        node->m_lastChild = child;
+    }
+
+    // With no parser, the native tokenizer gives the token being reported.
+    const char *tokSource;              // start of the input
+    const char *tokStart;               // the token
+    size_t     tokLen;
+    const char *lineScanned;            // newlines counted up to here
+    int        lineNo;                  // line of lineScanned
 };
 
+static inline int CurrentLine(wxXmlParsingContext *ctx)
+{
+    if (ctx->parser)
+        return (int)XML_GetCurrentLineNumber(ctx->parser) + ctx->lineBase;
+
+    // Tokens are reported in order, so each line end is only counted once.
+    // As with expat, "\r\n", "\r" and "\n" all end a line.
+    const char *p = ctx->lineScanned;
+    const char *end = ctx->tokStart;
+    while ((p = wxXmlSimd::FindFirstOf(p, end, '\n', '\r', '\n')) != end)
+    {
+        if (*p++ == '\r' && p != end && *p == '\n')
+            ++p;
+        ++ctx->lineNo;
+    }
+    ctx->lineScanned = p;
+    return ctx->lineNo + ctx->lineBase;
+}
+
+static inline size_t CurrentByte(wxXmlParsingContext *ctx)
+{
+    if (ctx->parser)
+        return (size_t)XML_GetCurrentByteIndex(ctx->parser) + ctx->srcBase;
+    return (size_t)(ctx->tokStart - ctx->tokSource) + ctx->srcBase;
+}
+
+static inline size_t CurrentByteCount(wxXmlParsingContext *ctx)
+{
+    if (ctx->parser)
+        return (size_t)XML_GetCurrentByteCount(ctx->parser);
+    return ctx->tokLen;
+}
+
 // checks that ctx->lastChild is in consistent state
 #define ASSERT_LAST_CHILD_OK(ctx)                                   \
     wxASSERT( ctx->lastChild == NULL ||                             \
@@ -617,14 +1035,54 @@ struct wxXmlParsingContext
     wxASSERT( ctx->lastChild == NULL ||                             \
               ctx->lastChild->GetParent() == ctx->node )
 
+// Expat reports character data in pieces, split at entities and at buffer
+// boundaries. They are collected in ctx->text and only converted and stored
+// in a node when something other than text follows.
+static void FlushText(wxXmlParsingContext *ctx)
+{
+    if (ctx->text.empty())
+        return;
+
+    wxString str = CharToString(ctx->conv, ctx->text.data(), ctx->text.length());
+    if (ctx->lastAsText)
+    {
+        ctx->lastAsText->SetContent(str);
+    }
+    else if (!ctx->removeWhiteOnlyNodes || !wxIsWhiteOnly(ctx->text))
+    {
+        wxXmlNode *textnode =
+            new wxXmlNode(wxXML_TEXT_NODE, wxS("text"), str, ctx->textLineNo);
+
+        ASSERT_LAST_CHILD_OK(ctx);
+        ctx->AddChild(textnode);
+        ctx->lastChild = textnode;
+    }
+    ctx->text.clear();
+}
+
 extern "C" {
 static void StartElementHnd(void *userData, const char *name, const char **atts)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth)
+    {
+        ctx->lazyDepth++;
+        return;
+    }
+    FlushText(ctx);
+
+    if (ctx->inProlog)
+    {
+        // DefaultHnd is only needed for the XML declaration.
+        if (ctx->parser)
+            XML_SetDefaultHandler(ctx->parser, NULL);
+        ctx->inProlog = false;
+    }
+
     wxXmlNode *node = new wxXmlNode(wxXML_ELEMENT_NODE,
                                     CharToString(ctx->conv, name),
                                     wxEmptyString,
-                                    XML_GetCurrentLineNumber(ctx->parser));
+                                    CurrentLine(ctx));
     const char **a = atts;
 
     // add node attributes
@@ -633,18 +1091,76 @@ static void StartElementHnd(void *userData, const char *name, const char **atts)
         node->AddAttribute(CharToString(ctx->conv, a[0]), CharToString(ctx->conv, a[1]));
         a += 2;
     }
+    if (ctx->anchors && node->GetAtom() == wxXML_ATOM_A &&
+            node->HasAttribute(wxXML_ATOM_HREF))
+        ctx->anchors->push_back(node);
+
+    if (ctx->keepSource)
+    {
+        // the end is only known once the element is complete
+        const size_t begin = CurrentByte(ctx);
+        ctx->startTagEnd = begin + CurrentByteCount(ctx);
+        node->SetSourceRange(begin, 0);
+        if (ctx->lazyFilter && ctx->lazyFilter(node))
+            ctx->lazyDepth = 1;
+    }
 
     ASSERT_LAST_CHILD_OK(ctx);
-    ctx->node->InsertChildAfter(node, ctx->lastChild);
-    ctx->lastAsText = NULL;
+    ctx->AddChild(node);
     ctx->lastChild = NULL; // our new node "node" has no children yet
 
     ctx->node = node;
 }
 
+// Completes the source range of the element being closed, if its bytes can
+// be copied as they are when it is saved.
+static void EndSourceRange(wxXmlParsingContext *ctx)
+{
+    wxXmlNode *node = ctx->node;
+    const size_t count = CurrentByteCount(ctx);
+    size_t end;
+    if (count == 0)
+    {
+        // An empty element tag, "<td/>" is always saved as "<td></td>".
+        if (node->GetAtom() == wxXML_ATOM_TD)
+            return;
+        end = ctx->startTagEnd;
+    }
+    else
+    {
+        end = CurrentByte(ctx) + count;
+    }
+
+    for (wxXmlNode *n = node->GetChildren(); n; n = n->GetNext())
+    {
+        if (n->GetType() == wxXML_ELEMENT_NODE && !n->HasSourceRange())
+            return;
+    }
+    node->SetSourceRange(node->GetSourceBegin(), end);
+}
+
 static void EndElementHnd(void *userData, const char* WXUNUSED(name))
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth > 1)
+    {
+        ctx->lazyDepth--;
+        return;
+    }
+    FlushText(ctx);
+    if (ctx->keepSource)
+        EndSourceRange(ctx);
+    if (ctx->lazyDepth)
+    {
+        // Left unparsed if there is anything to parse.
+        ctx->lazyDepth = 0;
+        if (CurrentByteCount(ctx) != 0 &&
+                ctx->node->HasSourceRange())
+        {
+            ctx->node->SetLazy();
+            ctx->lazyCount++;
+        }
+    }
 
     // we're exiting the last children of ctx->node->GetParent() and going
     // back one level up, so current value of ctx->node points to the last
@@ -652,53 +1168,41 @@ static void EndElementHnd(void *userData, const char* WXUNUSED(name))
     ctx->lastChild = ctx->node;
 
     ctx->node = ctx->node->GetParent();
-    ctx->lastAsText = NULL;
 }
 
 static void TextHnd(void *userData, const char *s, int len)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
-    wxString str = CharToString(ctx->conv, s, len);
-
-    if (ctx->lastAsText)
-    {
-        ctx->lastAsText->SetContent(ctx->lastAsText->GetContent() + str);
-    }
-    else
-    {
-        bool whiteOnly = false;
-        if (ctx->removeWhiteOnlyNodes)
-            whiteOnly = wxIsWhiteOnly(str);
+    if (ctx->lazyDepth)
+        return;
 
-        if (!whiteOnly)
-        {
-            wxXmlNode *textnode =
-                new wxXmlNode(wxXML_TEXT_NODE, wxS("text"), str,
-                              XML_GetCurrentLineNumber(ctx->parser));
-
-            ASSERT_LAST_CHILD_OK(ctx);
-            ctx->node->InsertChildAfter(textnode, ctx->lastChild);
-            ctx->lastChild= ctx->lastAsText = textnode;
-        }
-    }
+    if (ctx->text.empty())
+        ctx->textLineNo = CurrentLine(ctx);
+    ctx->text.append(s, len);
 }
 
 static void StartCdataHnd(void *userData)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth)
+        return;
+    FlushText(ctx);
 
     wxXmlNode *textnode =
         new wxXmlNode(wxXML_CDATA_SECTION_NODE, wxS("cdata"), wxS(""),
-                      XML_GetCurrentLineNumber(ctx->parser));
+                      CurrentLine(ctx));
 
     ASSERT_LAST_CHILD_OK(ctx);
-    ctx->node->InsertChildAfter(textnode, ctx->lastChild);
+    ctx->AddChild(textnode);
     ctx->lastChild= ctx->lastAsText = textnode;
 }
 
 static void EndCdataHnd(void *userData)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth)
+        return;
+    FlushText(ctx);
 
     // we need to reset this pointer so that subsequent text nodes don't append
     // their contents to this one but create new wxXML_TEXT_NODE objects (or
@@ -710,31 +1214,35 @@ static void EndCdataHnd(void *userData)
 static void CommentHnd(void *userData, const char *data)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth)
+        return;
+    FlushText(ctx);
 
     wxXmlNode *commentnode =
         new wxXmlNode(wxXML_COMMENT_NODE,
                       wxS("comment"), CharToString(ctx->conv, data),
-                      XML_GetCurrentLineNumber(ctx->parser));
+                      CurrentLine(ctx));
 
     ASSERT_LAST_CHILD_OK(ctx);
-    ctx->node->InsertChildAfter(commentnode, ctx->lastChild);
+    ctx->AddChild(commentnode);
     ctx->lastChild = commentnode;
-    ctx->lastAsText = NULL;
 }
 
 static void PIHnd(void *userData, const char *target, const char *data)
 {
     wxXmlParsingContext *ctx = (wxXmlParsingContext*)userData;
+    if (ctx->lazyDepth)
+        return;
+    FlushText(ctx);
 
     wxXmlNode *pinode =
         new wxXmlNode(wxXML_PI_NODE, CharToString(ctx->conv, target),
                       CharToString(ctx->conv, data),
-                      XML_GetCurrentLineNumber(ctx->parser));
+                      CurrentLine(ctx));
 
     ASSERT_LAST_CHILD_OK(ctx);
-    ctx->node->InsertChildAfter(pinode, ctx->lastChild);
+    ctx->AddChild(pinode);
     ctx->lastChild = pinode;
-    ctx->lastAsText = NULL;
 }
 
 static void StartDoctypeHnd(void *userData, const char *doctypeName, 
@@ -770,26 +1278,36 @@ static void DefaultHnd(void *userData, const char *s, int len)
 static int UnknownEncodingHnd(void * WXUNUSED(encodingHandlerData),
                               const XML_Char *name, XML_Encoding *info)
 {
-    // We must build conversion table for expat. The easiest way to do so
-    // is to let wxCSConv convert as string containing all characters to
-    // wide character representation:
-    wxCSConv conv(name);
-    char mbBuf[2];
-    wchar_t wcBuf[10];
-    size_t i;
+    // Tables already built on this thread, by encoding name.
+    static thread_local std::map<std::string, std::vector<int> > s_maps;
 
-    mbBuf[1] = 0;
-    info->map[0] = 0;
-    for (i = 0; i < 255; i++)
+    std::vector<int>& map = s_maps[name];
+    if (map.empty())
     {
-        mbBuf[0] = (char)(i+1);
-        if (conv.MB2WC(wcBuf, mbBuf, 2) == (size_t)-1)
+        // We must build conversion table for expat. The easiest way to do so
+        // is to let wxCSConv convert as string containing all characters to
+        // wide character representation:
+        wxCSConv conv(name);
+        char mbBuf[2];
+        wchar_t wcBuf[10];
+        size_t i;
+
+        map.resize(256);
+        mbBuf[1] = 0;
+        map[0] = 0;
+        for (i = 0; i < 255; i++)
         {
-            // invalid/undefined byte in the encoding:
-            info->map[i+1] = -1;
+            mbBuf[0] = (char)(i+1);
+            if (conv.MB2WC(wcBuf, mbBuf, 2) == (size_t)-1)
+            {
+                // invalid/undefined byte in the encoding:
+                map[i+1] = -1;
+            }
+            else
+                map[i+1] = (int)wcBuf[0];
         }
-        info->map[i+1] = (int)wcBuf[0];
     }
+    memcpy(info->map, &map[0], sizeof(info->map));
 
     info->data = NULL;
     info->convert = NULL;
@@ -800,30 +1318,115 @@ static int UnknownEncodingHnd(void * WXUNUSED(encodingHandlerData),
 
 } // extern "C"
 
-bool wxXmlDocument::Load(wxInputStream& stream, const wxString& encoding, int flags)
+namespace
 {
-#if wxUSE_UNICODE
-    (void)encoding;
-#else
-    m_encoding = encoding;
-#endif
 
-    const size_t BUFSIZE = 1024;
-    char buf[BUFSIZE];
-    wxXmlParsingContext ctx;
-    bool done;
-    XML_Parser parser = XML_ParserCreate(NULL);
-    wxXmlNode *root = new wxXmlNode(wxXML_DOCUMENT_NODE, wxEmptyString);
+// Parsers are kept once a document is loaded and reset for the next one
+// instead of being freed and created again. There is a pool per thread, so
+// no locking is needed.
+class wxXmlParserPool
+{
+public:
+    ~wxXmlParserPool()
+    {
+        for ( size_t i = 0; i < m_parsers.size(); i++ )
+            XML_ParserFree(m_parsers[i]);
+    }
 
-    ctx.encoding = wxS("UTF-8"); // default in absence of encoding=""
-    ctx.conv = NULL;
-#if !wxUSE_UNICODE
-    if ( encoding.CmpNoCase(wxS("UTF-8")) != 0 )
-        ctx.conv = new wxCSConv(encoding);
-#endif
-    ctx.removeWhiteOnlyNodes = (flags & wxXMLDOC_KEEP_WHITESPACE_NODES) == 0;
+    XML_Parser Get()
+    {
+        if ( m_parsers.empty() )
+        {
+            XML_Parser parser = XML_ParserCreate(NULL);
+            // This is the one handler XML_ParserReset() leaves in place.
+            XML_SetUnknownEncodingHandler(parser, UnknownEncodingHnd, NULL);
+            return parser;
+        }
+        XML_Parser parser = m_parsers.back();
+        m_parsers.pop_back();
+        return parser;
+    }
+
+    // The parser is reset here, so it is ready for use when next taken.
+    void Put(XML_Parser parser)
+    {
+        if ( m_parsers.size() < MAX_POOLED && XML_ParserReset(parser, NULL) )
+            m_parsers.push_back(parser);
+        else
+            XML_ParserFree(parser);
+    }
+
+private:
+    // More than one is only needed if a document is loaded while another
+    // is being parsed.
+    enum { MAX_POOLED = 4 };
+
+    std::vector<XML_Parser> m_parsers;
+};
+
+thread_local wxXmlParserPool gs_parserPool;
+
+} // anonymous namespace
+
+// The document node of a document loaded with wxXMLDOC_KEEP_SOURCE, owning
+// the copy of the input that its elements' source ranges refer to.
+class wxXmlSourceDocNode : public wxXmlNode
+{
+public:
+    wxXmlSourceDocNode(const char *buf, size_t len)
+        : wxXmlNode(wxXML_DOCUMENT_NODE, wxEmptyString),
+          m_source(buf, len),
+          m_prologEnd(0),
+          m_prologLines(0),
+          m_copyable(true)
+    {}
+
+    virtual const std::string *GetSourceBuffer() const
+        { return m_copyable && !m_source.empty() ? &m_source : NULL; }
+    virtual const wxXmlSourceDocNode *GetSourceDocNode() const { return this; }
+
+    // Used when the input turns out not to be UTF-8. Lazy elements still
+    // parse their children from it, so it is only freed if there are none.
+    void DropSource(bool keepForLazy)
+    {
+        m_copyable = false;
+        if (!keepForLazy)
+            std::string().swap(m_source);
+    }
+
+    void SetEncoding(const wxString& encoding) { m_encoding = encoding; }
+
+    // The prolog is everything before the root element: the declaration,
+    // the DOCTYPE with its internal subset and any comments. It is parsed
+    // again in front of a lazy element, so its entities are still known.
+    void SetProlog(size_t end)
+    {
+        m_prologEnd = end;
+        m_prologLines = (int)std::count(m_source.begin(),
+                                        m_source.begin() + end, '\n');
+    }
+
+    const std::string& GetSource() const { return m_source; }
+    const wxString& GetEncoding() const { return m_encoding; }
+    size_t GetPrologEnd() const { return m_prologEnd; }
+    int GetPrologLines() const { return m_prologLines; }
+
+private:
+    std::string m_source;
+    wxString    m_encoding;    // as found in the XML declaration
+    size_t      m_prologEnd;   // where the root element starts
+    int         m_prologLines; // line ends in the prolog
+    bool        m_copyable;    // the source can be saved as UTF-8
+};
+
+namespace
+{
+
+// Gets a parser from the pool and points its handlers at ctx.
+XML_Parser StartXmlParser(wxXmlParsingContext& ctx)
+{
+    XML_Parser parser = gs_parserPool.Get();
     ctx.parser = parser;
-    ctx.node = root;
 
     XML_SetUserData(parser, (void*)&ctx);
     XML_SetElementHandler(parser, StartElementHnd, EndElementHnd);
@@ -833,163 +1436,944 @@ bool wxXmlDocument::Load(wxInputStream& stream, const wxString& encoding, int fl
     XML_SetProcessingInstructionHandler(parser, PIHnd);
     XML_SetDoctypeDeclHandler(parser, StartDoctypeHnd, EndDoctypeHnd);
     XML_SetDefaultHandler(parser, DefaultHnd);
-    XML_SetUnknownEncodingHandler(parser, UnknownEncodingHnd, NULL);
+    return parser;
+}
+
+void LogXmlError(wxXmlParsingContext& ctx)
+{
+    wxString error(XML_ErrorString(XML_GetErrorCode(ctx.parser)),
+                   *wxConvCurrent);
+    wxLogError(_("XML parsing error: '%s' at line %d"),
+               error.c_str(),
+               CurrentLine(&ctx));
+}
+
+// Runs the parser over buf, adding what it finds to ctx.node. The encoding
+// is used in place of the one the input declares, if it isn't NULL.
+bool ParseXml(wxXmlParsingContext& ctx, const char *buf, size_t len,
+              const XML_Char *encoding)
+{
+    XML_Parser parser = StartXmlParser(ctx);
+    if (encoding)
+        XML_SetEncoding(parser, encoding);
+
+    // The whole document is handed to expat in one go, it is only split if
+    // it is too big for a single call.
+    bool ok = true;
+    const size_t MAXCHUNK = INT_MAX / 2;
+    do
+    {
+        size_t chunk = wxMin(len, MAXCHUNK);
+        len -= chunk;
+        if (!XML_Parse(parser, buf, (int)chunk, len == 0))
+        {
+            LogXmlError(ctx);
+            ok = false;
+            break;
+        }
+        buf += chunk;
+    } while (len != 0);
+
+    if (ok)
+        FlushText(&ctx);
+    gs_parserPool.Put(parser);
+    return ok;
+}
+
+// The wxWidgets way, for wxXMLDOC_READ_CHUNKS: a small buffer is read from
+// the stream and parsed until a read comes up short.
+bool ParseXmlStream(wxXmlParsingContext& ctx, wxInputStream& stream)
+{
+    const size_t BUFSIZE = 1024;
+    char buf[BUFSIZE];
+    XML_Parser parser = StartXmlParser(ctx);
 
     bool ok = true;
+    bool done;
     do
     {
         size_t len = stream.Read(buf, BUFSIZE).LastRead();
         done = (len < BUFSIZE);
-        if (!XML_Parse(parser, buf, len, done))
+        if (!XML_Parse(parser, buf, (int)len, done))
         {
-            wxString error(XML_ErrorString(XML_GetErrorCode(parser)),
-                           *wxConvCurrent);
-            wxLogError(_("XML parsing error: '%s' at line %d"),
-                       error.c_str(),
-                       (int)XML_GetCurrentLineNumber(parser));
+            LogXmlError(ctx);
             ok = false;
             break;
         }
     } while (!done);
 
     if (ok)
+        FlushText(&ctx);
+    gs_parserPool.Put(parser);
+    return ok;
+}
+
+// The named entities accepted by the native tokenizer: the five XML ones and
+// the HTML ones met in hand written pages. Expat stops at the HTML ones, as
+// there is no DTD to define them.
+struct wxXmlNamedEntity
+{
+    const char *name;
+    const char *utf8;
+};
+
+const wxXmlNamedEntity s_namedEntities[] =
+{
+    { "amp", "&" }, { "lt", "<" }, { "gt", ">" }, { "quot", "\"" },
+    { "apos", "'" },
+    { "nbsp", "\xC2\xA0" }, { "iexcl", "\xC2\xA1" }, { "cent", "\xC2\xA2" },
+    { "pound", "\xC2\xA3" }, { "yen", "\xC2\xA5" }, { "sect", "\xC2\xA7" },
+    { "copy", "\xC2\xA9" }, { "laquo", "\xC2\xAB" }, { "reg", "\xC2\xAE" },
+    { "deg", "\xC2\xB0" }, { "plusmn", "\xC2\xB1" }, { "sup2", "\xC2\xB2" },
+    { "sup3", "\xC2\xB3" }, { "para", "\xC2\xB6" }, { "middot", "\xC2\xB7" },
+    { "raquo", "\xC2\xBB" }, { "frac14", "\xC2\xBC" }, { "frac12", "\xC2\xBD" },
+    { "frac34", "\xC2\xBE" }, { "iquest", "\xC2\xBF" },
+    { "Agrave", "\xC3\x80" }, { "Aacute", "\xC3\x81" }, { "Auml", "\xC3\x84" },
+    { "Ccedil", "\xC3\x87" }, { "Egrave", "\xC3\x88" }, { "Eacute", "\xC3\x89" },
+    { "Ouml", "\xC3\x96" }, { "times", "\xC3\x97" }, { "Uuml", "\xC3\x9C" },
+    { "szlig", "\xC3\x9F" }, { "agrave", "\xC3\xA0" }, { "aacute", "\xC3\xA1" },
+    { "acirc", "\xC3\xA2" }, { "auml", "\xC3\xA4" }, { "ccedil", "\xC3\xA7" },
+    { "egrave", "\xC3\xA8" }, { "eacute", "\xC3\xA9" }, { "ecirc", "\xC3\xAA" },
+    { "euml", "\xC3\xAB" }, { "iuml", "\xC3\xAF" }, { "ocirc", "\xC3\xB4" },
+    { "ouml", "\xC3\xB6" }, { "divide", "\xC3\xB7" }, { "uuml", "\xC3\xBC" },
+    { "ndash", "\xE2\x80\x93" }, { "mdash", "\xE2\x80\x94" },
+    { "lsquo", "\xE2\x80\x98" }, { "rsquo", "\xE2\x80\x99" },
+    { "sbquo", "\xE2\x80\x9A" }, { "ldquo", "\xE2\x80\x9C" },
+    { "rdquo", "\xE2\x80\x9D" }, { "dagger", "\xE2\x80\xA0" },
+    { "bull", "\xE2\x80\xA2" }, { "hellip", "\xE2\x80\xA6" },
+    { "prime", "\xE2\x80\xB2" }, { "euro", "\xE2\x82\xAC" },
+    { "trade", "\xE2\x84\xA2" }, { "larr", "\xE2\x86\x90" },
+    { "uarr", "\xE2\x86\x91" }, { "rarr", "\xE2\x86\x92" },
+    { "darr", "\xE2\x86\x93" }
+};
+
+inline bool IsNameChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' ||
+           c == ':' || (c & 0x80);
+}
+
+inline bool IsSpaceChar(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Appends one code point to out as UTF-8.
+inline void AppendCodePoint(std::string& out, wxUint32 c)
+{
+    if ( c < 0x80 )
     {
-        if (!ctx.version.empty())
-            SetVersion(ctx.version);
-        if (!ctx.encoding.empty())
-            SetFileEncoding(ctx.encoding);
-        SetDocumentNode(root);
+        out += char(c);
+    }
+    else if ( c < 0x800 )
+    {
+        out += char(0xC0 | (c >> 6));
+        out += char(0x80 | (c & 0x3F));
+    }
+    else if ( c < 0x10000 )
+    {
+        out += char(0xE0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3F));
+        out += char(0x80 | (c & 0x3F));
     }
     else
     {
-        delete root;
+        out += char(0xF0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3F));
+        out += char(0x80 | ((c >> 6) & 0x3F));
+        out += char(0x80 | (c & 0x3F));
+    }
+}
+
+// A tokenizer for UTF-8 XHTML, used in place of expat when
+// wxXML_PARSER_NATIVE is chosen. It calls the same handlers, so builds the
+// same tree, and scans text with wxXmlSimd. Named HTML entities are
+// resolved, any other reference is an error, as it is to expat.
+// Encodings other than UTF-8, and DTDs, are left to expat. The input is not
+// checked for invalid UTF-8.
+class wxXmlNativeParser
+{
+public:
+    wxXmlNativeParser(wxXmlParsingContext& ctx, const char *buf, size_t len)
+        : m_ctx(ctx), m_pos(buf), m_end(buf + len), m_docStart(buf),
+          m_seenRoot(false)
+    {
+        m_ctx.tokSource = m_ctx.tokStart = m_ctx.lineScanned = buf;
     }
 
-    XML_ParserFree(parser);
-#if !wxUSE_UNICODE
-    if ( ctx.conv )
-        delete ctx.conv;
-#endif
+    // True if the input declares no encoding other than UTF-8.
+    static bool CanParse(const char *buf, size_t len);
 
-    return ok;
+    // Logs an error and returns false if the input is not well-formed.
+    bool Parse();
+
+private:
+    void Report(const char *start, const char *end)
+    {
+        m_ctx.tokStart = start;
+        m_ctx.tokLen = end - start;
+    }
+    bool Fail(const char *error);
+
+    bool ParseText();
+    bool ParseMarkup();
+    bool ParseStartTag();
+    bool ParseEndTag();
+    bool ParseComment();
+    bool ParseCdata();
+    bool ParseDoctype();
+    bool ParsePI();
+
+    const char *SkipName(const char *p) const;
+    const char *SkipSpace(const char *p) const;
+    const char *Find(const char *p, const char *seq) const;
+    const char *AppendEntity(const char *p, std::string& out);
+    void AppendNormalized(const char *s, const char *end, std::string& out) const;
+
+    wxXmlParsingContext& m_ctx;
+    const char *m_pos;
+    const char *m_end;
+    const char *m_docStart;                // after any byte order mark
+    bool m_seenRoot;
+    std::vector<std::string> m_open;       // names of the open elements
+    std::string m_scratch;
+    std::vector<std::string> m_attrs;
+    std::vector<const char *> m_attrPtrs;
+};
+
+bool wxXmlNativeParser::CanParse(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    if (len >= 2 && ((buf[0] == '\xFE' && buf[1] == '\xFF') ||
+                     (buf[0] == '\xFF' && buf[1] == '\xFE')))
+        return false;
+    if (len >= 3 && memcmp(buf, "\xEF\xBB\xBF", 3) == 0)
+        buf += 3;
+    if (end - buf < 6 || memcmp(buf, "<?xml ", 6) != 0)
+        return true;
 
+    const char *declEnd = std::search(buf, end, "?>", "?>" + 2);
+    std::string decl(buf, declEnd);
+    const size_t pos = decl.find("encoding=");
+    if (pos == std::string::npos || pos + 10 > decl.length())
+        return true;
+    std::string enc = decl.substr(pos + 10);
+    enc = enc.substr(0, enc.find(decl[pos + 9]));
+    for (size_t i = 0; i < enc.length(); i++)
+        if (enc[i] >= 'A' && enc[i] <= 'Z')
+            enc[i] += 'a' - 'A';
+    return enc == "utf-8" || enc == "us-ascii";
 }
 
+bool wxXmlNativeParser::Fail(const char *error)
+{
+    Report(m_pos, m_pos);
+    wxLogError(_("XML parsing error: '%s' at line %d"),
+               wxString(error), CurrentLine(&m_ctx));
+    return false;
+}
 
+bool wxXmlNativeParser::Parse()
+{
+    if (m_end - m_pos >= 3 && memcmp(m_pos, "\xEF\xBB\xBF", 3) == 0)
+        m_pos += 3;
+    m_docStart = m_pos;
 
-//-----------------------------------------------------------------------------
-//  wxXmlDocument saving routines
-//-----------------------------------------------------------------------------
+    while (m_pos != m_end)
+    {
+        if (!(*m_pos == '<' ? ParseMarkup() : ParseText()))
+            return false;
+    }
+    if (!m_seenRoot || !m_open.empty())
+        return Fail("no element found");
+    FlushText(&m_ctx);
+    return true;
+}
 
-// helpers for XML generation
-namespace
+const char *wxXmlNativeParser::SkipName(const char *p) const
 {
+    while (p != m_end && IsNameChar(*p))
+        ++p;
+    return p;
+}
 
-// write string to output:
-bool OutputString(wxOutputStream& stream,
-                  const wxString& str,
-                  wxMBConv *convMem,
-                  wxMBConv *convFile)
+const char *wxXmlNativeParser::SkipSpace(const char *p) const
 {
-    if (str.empty())
-        return true;
+    while (p != m_end && IsSpaceChar(*p))
+        ++p;
+    return p;
+}
 
-#if wxUSE_UNICODE
-    wxUnusedVar(convMem);
-    if ( !convFile )
-        convFile = &wxConvUTF8;
+// Returns the start of seq at or after p, or NULL.
+const char *wxXmlNativeParser::Find(const char *p, const char *seq) const
+{
+    const char *found = std::search(p, m_end, seq, seq + strlen(seq));
+    return found == m_end ? NULL : found;
+}
 
-    const wxScopedCharBuffer buf(str.mb_str(*convFile));
-    if ( !buf.length() )
+// Appends the character of the reference at p, returning the end of it.
+// A reference that isn't known is logged and NULL returned, so a stored
+// statement is never saved with the reference escaped.
+const char *wxXmlNativeParser::AppendEntity(const char *p, std::string& out)
+{
+    const char *name = p + 1;
+    const char *semi = SkipName(name != m_end && *name == '#' ? name + 1 : name);
+    if (semi == m_end || *semi != ';' || semi == name)
     {
-        // conversion failed, can't write this string in an XML file in this
-        // (presumably non-UTF-8) encoding
-        return false;
+        m_pos = p;
+        Fail("not well-formed (invalid token)");
+        return NULL;
     }
 
-    stream.Write(buf, buf.length());
-#else // !wxUSE_UNICODE
-    if ( convFile && convMem )
+    const std::string ref(name, semi);
+    if (ref[0] == '#')
     {
-        wxString str2(str.wc_str(*convMem), *convFile);
-        stream.Write(str2.mb_str(), str2.length());
+        char *numEnd;
+        const unsigned long c = ref.length() > 1 && ref[1] == 'x'
+            ? strtoul(ref.c_str() + 2, &numEnd, 16)
+            : strtoul(ref.c_str() + 1, &numEnd, 10);
+        if (*numEnd == '\0' && c != 0 && c <= 0x10FFFF &&
+                (c < 0xD800 || c > 0xDFFF))
+        {
+            AppendCodePoint(out, (wxUint32)c);
+            return semi + 1;
+        }
+        m_pos = p;
+        Fail("reference to invalid character number");
+        return NULL;
     }
-    else // no conversions to do
+    for (size_t i = 0; i < WXSIZEOF(s_namedEntities); i++)
     {
-        stream.Write(str.mb_str(), str.length());
+        if (ref == s_namedEntities[i].name)
+        {
+            out += s_namedEntities[i].utf8;
+            return semi + 1;
+        }
     }
-#endif // wxUSE_UNICODE/!wxUSE_UNICODE
-
-    return stream.IsOk();
+    m_pos = p;
+    Fail("undefined entity");
+    return NULL;
 }
 
-enum EscapingMode
+// Appends [s, end) with line ends as "\n", as expat does.
+void wxXmlNativeParser::AppendNormalized(const char *s, const char *end,
+                                         std::string& out) const
 {
-    Escape_Text,
-    Escape_Attribute
-};
+    for (;;)
+    {
+        const char *cr = (const char *)memchr(s, '\r', end - s);
+        if (!cr)
+            break;
+        out.append(s, cr);
+        out += '\n';
+        s = cr + 1;
+        if (s != end && *s == '\n')
+            ++s;
+    }
+    out.append(s, end);
+}
 
-// Same as above, but create entities first.
-// Translates '<' to "&lt;", '>' to "&gt;" and so on, according to the spec:
-// http://www.w3.org/TR/2000/WD-xml-c14n-20000119.html#charescaping
-bool OutputEscapedString(wxOutputStream& stream,
-                         const wxString& str,
-                         wxMBConv *convMem,
-                         wxMBConv *convFile,
-                         EscapingMode mode)
+bool wxXmlNativeParser::ParseText()
 {
-    wxString escaped;
-    escaped.reserve(str.length());
-
-    for ( wxString::const_iterator i = str.begin(); i != str.end(); ++i )
+    const char *p = m_pos;
+    if (m_open.empty())
     {
-        const wxChar c = *i;
-
-        switch ( c )
+        p = SkipSpace(p);
+        if (p != m_end && *p != '<')
         {
-            case wxS('<'):
-                escaped.append(wxS("&lt;"));
-                break;
-            case wxS('>'):
-                escaped.append(wxS("&gt;"));
-                break;
-            case wxS('&'):
-                escaped.append(wxS("&amp;"));
-                break;
-            case wxS('\r'):
-                escaped.append(wxS("&#xD;"));
-                break;
-            default:
-                if ( mode == Escape_Attribute )
-                {
-                    switch ( c )
-                    {
-                        case wxS('"'):
-                            escaped.append(wxS("&quot;"));
-                            break;
-                        case wxS('\t'):
-                            escaped.append(wxS("&#x9;"));
-                            break;
-                        case wxS('\n'):
-                            escaped.append(wxS("&#xA;"));
-                            break;
-                        default:
-                            escaped.append(c);
-                    }
-
-                }
-                else
-                {
-                    escaped.append(c);
-                }
+            m_pos = p;
+            return Fail(m_seenRoot ? "junk after document element"
+                                   : "syntax error");
         }
+        m_pos = p;
+        return true;
     }
 
-    return OutputString(stream, escaped, convMem, convFile);
+    // Runs of plain text are passed on as they are, only the characters
+    // found by the scan need any work.
+    std::string& decoded = m_scratch;
+    while (p != m_end && *p != '<')
+    {
+        const char *hit = wxXmlSimd::FindFirstOf(p, m_end, '<', '&', '\r');
+        if (hit != p)
+        {
+            Report(p, hit);
+            TextHnd(&m_ctx, p, (int)(hit - p));
+            p = hit;
+            continue;
+        }
+        Report(p, p + 1);
+        decoded.clear();
+        if (*p == '\r')
+        {
+            decoded = "\n";
+            if (++p != m_end && *p == '\n')
+                ++p;
+        }
+        else
+        {
+            p = AppendEntity(p, decoded);
+            if (!p)
+                return false;
+        }
+        TextHnd(&m_ctx, decoded.data(), (int)decoded.length());
+    }
+    m_pos = p;
+    return true;
 }
 
-bool OutputIndentation(wxOutputStream& stream,
-                       int indent,
+bool wxXmlNativeParser::ParseMarkup()
+{
+    const char *p = m_pos + 1;
+    if (p == m_end)
+        return Fail("unclosed token");
+    if (*p == '/')
+        return ParseEndTag();
+    if (*p == '?')
+        return ParsePI();
+    if (*p == '!')
+    {
+        if (m_end - p >= 3 && memcmp(p, "!--", 3) == 0)
+            return ParseComment();
+        if (m_end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0)
+            return ParseCdata();
+        if (m_end - p >= 8 && memcmp(p, "!DOCTYPE", 8) == 0)
+            return ParseDoctype();
+        return Fail("not well-formed (invalid token)");
+    }
+    return ParseStartTag();
+}
+
+bool wxXmlNativeParser::ParseStartTag()
+{
+    const char *start = m_pos;
+    const char *name = start + 1;
+    const char *p = SkipName(name);
+    if (p == name)
+        return Fail("not well-formed (invalid token)");
+    if (m_open.empty() && m_seenRoot)
+        return Fail("junk after document element");
+
+    m_attrs.clear();
+    for (;;)
+    {
+        const char *attr = SkipSpace(p);
+        if (attr == m_end)
+            return Fail("unclosed token");
+        if (*attr == '>' || *attr == '/')
+        {
+            p = attr;
+            break;
+        }
+        if (attr == p)
+        {
+            m_pos = attr;
+            return Fail("not well-formed (invalid token)");
+        }
+        p = SkipName(attr);
+        if (p == attr)
+        {
+            m_pos = attr;
+            return Fail("not well-formed (invalid token)");
+        }
+        m_attrs.push_back(std::string(attr, p));
+        p = SkipSpace(p);
+        if (p == m_end || *p != '=')
+        {
+            m_pos = p;
+            return Fail("not well-formed (invalid token)");
+        }
+        p = SkipSpace(p + 1);
+        if (p == m_end || (*p != '"' && *p != '\''))
+        {
+            m_pos = p;
+            return Fail("not well-formed (invalid token)");
+        }
+
+        // Attribute values have their white space made into spaces.
+        const char quote = *p++;
+        std::string value;
+        for (;;)
+        {
+            const char *hit = wxXmlSimd::FindFirstOf(p, m_end, quote, '&', '<');
+            const size_t from = value.length();
+            AppendNormalized(p, hit, value);
+            for (size_t i = from; i < value.length(); i++)
+            {
+                if (value[i] == '\t' || value[i] == '\n')
+                    value[i] = ' ';
+            }
+            p = hit;
+            if (p == m_end)
+                return Fail("unclosed token");
+            if (*p == '<')
+            {
+                m_pos = p;
+                return Fail("not well-formed (invalid token)");
+            }
+            if (*p == quote)
+                break;
+            p = AppendEntity(p, value);
+            if (!p)
+                return false;
+        }
+        ++p;
+        m_attrs.push_back(value);
+    }
+
+    const bool empty = *p == '/';
+    if (empty && (++p == m_end || *p != '>'))
+    {
+        m_pos = p;
+        return Fail("not well-formed (invalid token)");
+    }
+    m_pos = p + 1;
+
+    m_attrPtrs.clear();
+    for (size_t i = 0; i < m_attrs.size(); i++)
+        m_attrPtrs.push_back(m_attrs[i].c_str());
+    m_attrPtrs.push_back(NULL);
+
+    m_scratch.assign(name, SkipName(name));
+    Report(start, m_pos);
+    StartElementHnd(&m_ctx, m_scratch.c_str(), &m_attrPtrs[0]);
+    m_seenRoot = true;
+    if (empty)
+    {
+        // As with expat, the end of an empty element has no bytes.
+        Report(m_pos, m_pos);
+        EndElementHnd(&m_ctx, m_scratch.c_str());
+    }
+    else
+    {
+        m_open.push_back(m_scratch);
+    }
+    return true;
+}
+
+bool wxXmlNativeParser::ParseEndTag()
+{
+    const char *start = m_pos;
+    const char *name = start + 2;
+    const char *p = SkipName(name);
+    const char *gt = SkipSpace(p);
+    if (gt == m_end)
+        return Fail("unclosed token");
+    if (*gt != '>' || m_open.empty() ||
+            m_open.back().compare(0, std::string::npos, name, p - name) != 0)
+        return Fail("mismatched tag");
+
+    m_pos = gt + 1;
+    Report(start, m_pos);
+    EndElementHnd(&m_ctx, m_open.back().c_str());
+    m_open.pop_back();
+    return true;
+}
+
+bool wxXmlNativeParser::ParseComment()
+{
+    const char *start = m_pos;
+    const char *close = Find(start + 4, "-->");
+    if (!close)
+        return Fail("unclosed token");
+
+    m_scratch.clear();
+    AppendNormalized(start + 4, close, m_scratch);
+    m_pos = close + 3;
+    Report(start, m_pos);
+    CommentHnd(&m_ctx, m_scratch.c_str());
+    return true;
+}
+
+bool wxXmlNativeParser::ParseCdata()
+{
+    const char *start = m_pos;
+    const char *close = Find(start + 9, "]]>");
+    if (!close)
+        return Fail("unclosed token");
+    if (m_open.empty())
+        return Fail("syntax error");
+
+    m_scratch.clear();
+    AppendNormalized(start + 9, close, m_scratch);
+    m_pos = close + 3;
+    Report(start, m_pos);
+    StartCdataHnd(&m_ctx);
+    if (!m_scratch.empty())
+        TextHnd(&m_ctx, m_scratch.data(), (int)m_scratch.length());
+    EndCdataHnd(&m_ctx);
+    return true;
+}
+
+bool wxXmlNativeParser::ParseDoctype()
+{
+    if (m_seenRoot)
+        return Fail("syntax error");
+
+    // The DTD isn't read, just skipped, including any internal subset.
+    const char *p = m_pos + 9;
+    int depth = 0;
+    for ( ; p != m_end; ++p)
+    {
+        if (*p == '"' || *p == '\'')
+        {
+            const char *q = (const char *)memchr(p + 1, *p, m_end - p - 1);
+            if (!q)
+                break;
+            p = q;
+        }
+        else if (*p == '[')
+            ++depth;
+        else if (*p == ']')
+            --depth;
+        else if (*p == '>' && depth <= 0)
+        {
+            m_pos = p + 1;
+            return true;
+        }
+    }
+    return Fail("unclosed token");
+}
+
+bool wxXmlNativeParser::ParsePI()
+{
+    const char *start = m_pos;
+    const char *target = start + 2;
+    const char *p = SkipName(target);
+    const char *close = Find(p, "?>");
+    if (p == target || !close)
+        return Fail("unclosed token");
+
+    m_pos = close + 2;
+    Report(start, m_pos);
+    if (p - target == 3 && memcmp(target, "xml", 3) == 0)
+    {
+        if (start != m_docStart)
+        {
+            m_pos = start;
+            return Fail("XML or text declaration not at start of entity");
+        }
+        DefaultHnd(&m_ctx, start, (int)(m_pos - start));
+        return true;
+    }
+
+    m_scratch.clear();
+    AppendNormalized(SkipSpace(p), close, m_scratch);
+    const std::string name(target, p);
+    PIHnd(&m_ctx, name.c_str(), m_scratch.c_str());
+    return true;
+}
+
+// Parses with the parser chosen by wxXmlDocument::SetParser(), if it can
+// read the input.
+bool ParseInput(wxXmlParsingContext& ctx, const char *buf, size_t len,
+                const XML_Char *encoding)
+{
+    if (wxXmlDocument::GetParser() == wxXML_PARSER_NATIVE && !encoding &&
+            wxXmlNativeParser::CanParse(buf, len))
+        return wxXmlNativeParser(ctx, buf, len).Parse();
+    return ParseXml(ctx, buf, len, encoding);
+}
+
+} // anonymous namespace
+
+void wxXmlNode::ParseLazyChildren() const
+{
+    wxXmlNode *self = const_cast<wxXmlNode*>(this);
+    self->m_lazy = false;
+
+    const wxXmlNode *top = this;
+    while (top->m_parent)
+        top = top->m_parent;
+    const wxXmlSourceDocNode *doc = top->GetSourceDocNode();
+    wxCHECK_RET( doc && HasSourceRange(), "lazy element is not in its document" );
+    const std::string& source = doc->GetSource();
+    wxCHECK_RET( m_srcBegin >= doc->GetPrologEnd() && m_srcEnd <= source.length(),
+                 "lazy element outside the source" );
+
+    // The element is parsed again, after the document's prolog, as the
+    // root of a scratch document and its children are moved across. Ranges
+    // and line numbers are made to match those of a complete load.
+    const size_t prologEnd = doc->GetPrologEnd();
+    std::string input;
+    input.reserve(prologEnd + m_srcEnd - m_srcBegin);
+    input.append(source, 0, prologEnd);
+    input.append(source, m_srcBegin, m_srcEnd - m_srcBegin);
+
+    wxXmlNode scratch(wxXML_DOCUMENT_NODE, wxEmptyString);
+    wxXmlParsingContext ctx;
+    ctx.node = &scratch;
+    ctx.keepSource = true;
+    ctx.srcBase = m_srcBegin - prologEnd;
+    ctx.lineBase = m_lineNo - 1 - doc->GetPrologLines();
+
+    const wxString& encoding = doc->GetEncoding();
+    const bool utf8 = encoding.empty() ||
+                      encoding.CmpNoCase(wxS("UTF-8")) == 0 ||
+                      encoding.CmpNoCase(wxS("US-ASCII")) == 0;
+    wxXmlNode *copy = NULL;
+    if (ParseInput(ctx, input.data(), input.length(),
+                   utf8 ? NULL : (const XML_Char*)encoding.utf8_str().data()))
+    {
+        copy = scratch.m_lastChild;
+        if (copy && copy->m_type != wxXML_ELEMENT_NODE)
+            copy = NULL;
+    }
+    if (!copy)
+    {
+        // Keep what is between the tags as a single unescaped text node,
+        // so the element is still saved as it was read.
+        self->SetVerbatimChildren(source, utf8 ? wxString() : encoding);
+        return;
+    }
+    self->m_children = copy->m_children;
+    self->m_lastChild = copy->m_lastChild;
+    for (wxXmlNode *n = m_children; n; n = n->m_next)
+        n->m_parent = self;
+    copy->m_children = copy->m_lastChild = NULL;
+}
+
+void wxXmlNode::SetVerbatimChildren(const std::string& source,
+                                    const wxString& encoding)
+{
+    // Skip the start tag, minding quoted attribute values.
+    size_t begin = m_srcBegin;
+    char quote = 0;
+    for ( ; begin < m_srcEnd; ++begin)
+    {
+        const char c = source[begin];
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+            quote = c;
+        else if (c == '>')
+            break;
+    }
+    if (begin >= m_srcEnd || source[begin - 1] == '/')
+        return; // an empty element
+    ++begin;
+    size_t end = source.rfind("</", m_srcEnd - 2);
+    if (end == std::string::npos || end < begin)
+        return;
+
+    const char *inner = source.data() + begin;
+    wxString content = encoding.empty()
+        ? wxString::FromUTF8(inner, end - begin)
+        : wxString(inner, wxCSConv(encoding), end - begin);
+    wxXmlNode *text = new wxXmlNode(wxXML_TEXT_NODE, wxS("text"), content);
+    text->SetNoConversion(true);
+    text->m_parent = this;
+    m_children = m_lastChild = text;
+}
+
+bool wxXmlDocument::Load(wxInputStream& stream, const wxString& encoding, int flags)
+{
+    if (flags & wxXMLDOC_READ_CHUNKS)
+        return DoLoad(NULL, 0, &stream, encoding, flags);
+
+    std::string buf;
+    ReadWholeStream(stream, buf);
+    return DoLoad(buf.data(), buf.length(), NULL, encoding, flags);
+}
+
+bool wxXmlDocument::Load(const char *buf, size_t len, const wxString& encoding, int flags)
+{
+    return DoLoad(buf, len, NULL, encoding, flags);
+}
+
+bool wxXmlDocument::DoLoad(const char *buf, size_t len, wxInputStream *stream,
+                           const wxString& encoding, int flags)
+{
+#if wxUSE_UNICODE
+    (void)encoding;
+#else
+    m_encoding = encoding;
+#endif
+
+    // Ranges are held in 32 bits, and a UTF-16 byte order mark means the
+    // input can't be copied into UTF-8 output.
+    const bool keepSource = !stream &&
+                            (flags & wxXMLDOC_KEEP_SOURCE) &&
+                            (flags & wxXMLDOC_KEEP_WHITESPACE_NODES) &&
+                            len < 0xFFFFFFFF &&
+                            !(len >= 2 && ((buf[0] == '\xFE' && buf[1] == '\xFF') ||
+                                           (buf[0] == '\xFF' && buf[1] == '\xFE')));
+
+    wxXmlParsingContext ctx;
+    wxXmlNode *root = keepSource
+        ? new wxXmlSourceDocNode(buf, len)
+        : new wxXmlNode(wxXML_DOCUMENT_NODE, wxEmptyString);
+
+    ctx.encoding = wxS("UTF-8"); // default in absence of encoding=""
+    ctx.conv = NULL;
+#if !wxUSE_UNICODE
+    if ( encoding.CmpNoCase(wxS("UTF-8")) != 0 )
+        ctx.conv = new wxCSConv(encoding);
+#endif
+    ctx.removeWhiteOnlyNodes = (flags & wxXMLDOC_KEEP_WHITESPACE_NODES) == 0;
+    ctx.node = root;
+    ctx.keepSource = keepSource;
+#if wxUSE_UNICODE
+    // Lazy elements are parsed later without the conversion used here.
+    if (keepSource && (flags & wxXMLDOC_LAZY))
+        ctx.lazyFilter = m_lazyFilter;
+#endif
+    m_anchors.clear();
+    if (flags & wxXMLDOC_INDEX_ANCHORS)
+        ctx.anchors = &m_anchors;
+
+    const bool ok = stream ? ParseXmlStream(ctx, *stream)
+                           : ParseInput(ctx, buf, len, NULL);
+    if (ok)
+    {
+        if (!ctx.version.empty())
+            SetVersion(ctx.version);
+        if (!ctx.encoding.empty())
+            SetFileEncoding(ctx.encoding);
+        if (keepSource)
+        {
+            wxXmlSourceDocNode *doc = static_cast<wxXmlSourceDocNode*>(root);
+            doc->SetEncoding(ctx.encoding);
+            for (wxXmlNode *n = root->GetChildren(); n; n = n->GetNext())
+            {
+                if (n->GetType() == wxXML_ELEMENT_NODE && n->HasSourceRange())
+                {
+                    doc->SetProlog(n->GetSourceBegin());
+                    break;
+                }
+            }
+            if (ctx.encoding.CmpNoCase(wxS("UTF-8")) != 0 &&
+                    ctx.encoding.CmpNoCase(wxS("US-ASCII")) != 0)
+            {
+                doc->DropSource(ctx.lazyCount != 0);
+            }
+        }
+        SetDocumentNode(root);
+    }
+    else
+    {
+        m_anchors.clear();
+        delete root;
+    }
+
+#if !wxUSE_UNICODE
+    if ( ctx.conv )
+        delete ctx.conv;
+#endif
+
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+//  wxXmlDocument saving routines
+//-----------------------------------------------------------------------------
+
+// helpers for XML generation
+namespace
+{
+
+// write string to output:
+bool OutputString(wxOutputStream& stream,
+                  const wxString& str,
+                  wxMBConv *convMem,
+                  wxMBConv *convFile)
+{
+    if (str.empty())
+        return true;
+
+#if wxUSE_UNICODE
+    wxUnusedVar(convMem);
+    if ( !convFile )
+        convFile = &wxConvUTF8;
+
+    const wxScopedCharBuffer buf(str.mb_str(*convFile));
+    if ( !buf.length() )
+    {
+        // conversion failed, can't write this string in an XML file in this
+        // (presumably non-UTF-8) encoding
+        return false;
+    }
+
+    stream.Write(buf, buf.length());
+#else // !wxUSE_UNICODE
+    if ( convFile && convMem )
+    {
+        wxString str2(str.wc_str(*convMem), *convFile);
+        stream.Write(str2.mb_str(), str2.length());
+    }
+    else // no conversions to do
+    {
+        stream.Write(str.mb_str(), str.length());
+    }
+#endif // wxUSE_UNICODE/!wxUSE_UNICODE
+
+    return stream.IsOk();
+}
+
+enum EscapingMode
+{
+    Escape_Text,
+    Escape_Attribute
+};
+
+// The entity written in place of a character for which
+// wxXmlSimd::NeedsEscape() is true.
+const char *GetEscapeEntity(wxUint32 c)
+{
+    switch ( c )
+    {
+        case '<':  return "&lt;";
+        case '>':  return "&gt;";
+        case '&':  return "&amp;";
+        case '\r': return "&#xD;";
+        case '"':  return "&quot;";
+        case '\t': return "&#x9;";
+        case '\n': return "&#xA;";
+    }
+    return "";
+}
+
+// Same as above, but create entities first.
+// Translates '<' to "&lt;", '>' to "&gt;" and so on, according to the spec:
+// http://www.w3.org/TR/2000/WD-xml-c14n-20000119.html#charescaping
+bool OutputEscapedString(wxOutputStream& stream,
+                         const wxString& str,
+                         wxMBConv *convMem,
+                         wxMBConv *convFile,
+                         EscapingMode mode)
+{
+    const bool attribute = mode == Escape_Attribute;
+    const wxWX2WCbuf buf(str.wc_str());
+    const wchar_t *s = buf;
+    const wchar_t *end = s + str.length();
+    const wchar_t *esc = wxXmlSimd::FindEscape(s, end, attribute);
+    if ( esc == end )
+    {
+        // nothing to escape, which is the usual case
+        return OutputString(stream, str, convMem, convFile);
+    }
+
+    wxString escaped;
+    escaped.reserve(str.length() + 16);
+    for ( ;; )
+    {
+        escaped.append(s, esc - s);
+        if ( esc == end )
+            break;
+        escaped += GetEscapeEntity(*esc);
+        s = esc + 1;
+        esc = wxXmlSimd::FindEscape(s, end, attribute);
+    }
+
+    return OutputString(stream, escaped, convMem, convFile);
+}
+
+bool OutputIndentation(wxOutputStream& stream,
+                       int indent,
                        wxMBConv *convMem,
                        wxMBConv *convFile)
 {
@@ -1033,9 +2417,10 @@ bool OutputNode(wxOutputStream& stream,
 
             if ( rc )
             {
-                for ( wxXmlAttribute *attr = node->GetAttributes();
-                      attr && rc;
-                      attr = attr->GetNext() )
+                const wxXmlAttributeList& attrs = node->GetAttributes();
+                for ( wxXmlAttributeList::const_iterator attr = attrs.begin();
+                      attr != attrs.end() && rc;
+                      ++attr )
                 {
                     rc = OutputString(stream,
                                       wxS(" ") + attr->GetName() +  wxS("=\""),
@@ -1159,6 +2544,584 @@ bool wxXmlDocument::Save(wxOutputStream& stream, int indentstep, int flags) cons
     return rc;
 }
 
+namespace
+{
+
+// Appends the wide characters [s, end) to out as UTF-8. Runs of ASCII are
+// narrowed in bulk, only the other characters are encoded one by one.
+void AppendUtf8Run(std::string& out, const wchar_t *s, const wchar_t *end)
+{
+    while ( s != end )
+    {
+        const size_t n = wxXmlSimd::AsciiLength(s, end);
+        if ( n )
+        {
+            const size_t pos = out.size();
+            out.resize(pos + n);
+            wxXmlSimd::NarrowAscii(s, n, &out[pos]);
+            s += n;
+            if ( s == end )
+                break;
+        }
+
+        wxUint32 c = wxUint32(*s++);
+        // Where wchar_t is 16 bits a character may be a surrogate pair.
+        if ( c >= 0xD800 && c < 0xDC00 && s != end )
+        {
+            const wxUint32 lo = wxUint32(*s);
+            if ( lo >= 0xDC00 && lo < 0xE000 )
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (lo - 0xDC00);
+                ++s;
+            }
+        }
+        AppendCodePoint(out, c);
+    }
+}
+
+// Appends str to out as UTF-8, escaped as OutputEscapedString() does when
+// escape is set. Nothing is allocated apart from growing out.
+void AppendUtf8(std::string& out, const wxString& str,
+                bool escape, EscapingMode mode = Escape_Text)
+{
+    const wxWX2WCbuf buf(str.wc_str());
+    const wchar_t *s = buf;
+    const wchar_t *end = s + str.length();
+    out.reserve(out.size() + str.length());
+    if ( !escape )
+    {
+        AppendUtf8Run(out, s, end);
+        return;
+    }
+    const bool attribute = mode == Escape_Attribute;
+    for ( ;; )
+    {
+        const wchar_t *esc = wxXmlSimd::FindEscape(s, end, attribute);
+        AppendUtf8Run(out, s, esc);
+        if ( esc == end )
+            break;
+        out.append(GetEscapeEntity(*esc));
+        s = esc + 1;
+    }
+}
+
+} // anonymous namespace
+
+namespace
+{
+
+// Writes node to out as UTF-8. Elements with a source range are copied from
+// source, when there is one.
+void SaveUtf8(const wxXmlNode *node, std::string& out, const std::string *source)
+{
+    switch (node->GetType())
+    {
+        case wxXML_CDATA_SECTION_NODE:
+            out.append("<![CDATA[");
+            AppendUtf8(out, node->GetContent(), false);
+            out.append("]]>");
+            break;
+
+        case wxXML_TEXT_NODE:
+            AppendUtf8(out, node->GetContent(), !node->GetNoConversion());
+            break;
+
+        case wxXML_ELEMENT_NODE:
+        {
+            if ( source && node->HasSourceRange() )
+            {
+                out.append(*source, node->GetSourceBegin(),
+                           node->GetSourceEnd() - node->GetSourceBegin());
+                break;
+            }
+            out += '<';
+            AppendUtf8(out, node->GetName(), false);
+            const wxXmlAttributeList& attrs = node->GetAttributes();
+            for ( wxXmlAttributeList::const_iterator attr = attrs.begin();
+                  attr != attrs.end();
+                  ++attr )
+            {
+                out += ' ';
+                AppendUtf8(out, attr->GetName(), false);
+                out.append("=\"");
+                AppendUtf8(out, attr->GetValue(), true, Escape_Attribute);
+                out += '"';
+            }
+            if ( node->GetChildren() )
+            {
+                out += '>';
+                for ( wxXmlNode *n = node->GetChildren(); n; n = n->GetNext() )
+                    SaveUtf8(n, out, source);
+                out.append("</");
+                AppendUtf8(out, node->GetName(), false);
+                out += '>';
+            }
+            else if ( node->GetAtom() == wxXML_ATOM_TD )
+            {
+                out.append("></td>");
+            }
+            else
+            {
+                out.append("/>");
+            }
+            break;
+        }
+
+        case wxXML_COMMENT_NODE:
+            out.append("<!--");
+            AppendUtf8(out, node->GetContent(), false);
+            out.append("-->");
+            break;
+
+        case wxXML_PI_NODE:
+            out.append("<?");
+            AppendUtf8(out, node->GetName(), false);
+            out += ' ';
+            AppendUtf8(out, node->GetContent(), false);
+            out.append("?>");
+            break;
+
+        case wxXML_DOCUMENT_NODE:
+            for ( wxXmlNode *n = node->GetChildren(); n; n = n->GetNext() )
+            {
+                SaveUtf8(n, out, source);
+                out += '\n';
+            }
+            break;
+
+        default:
+            wxFAIL_MSG("unsupported node type");
+    }
+}
+
+} // anonymous namespace
+
+/*static*/ void wxXmlDocument::Save(const wxXmlNode *node, std::string& out)
+{
+    const wxXmlNode *top = node;
+    while ( top->GetParent() )
+        top = top->GetParent();
+    SaveUtf8(node, out, top->GetSourceBuffer());
+}
+
+bool wxXmlDocument::Save(std::string& out) const
+{
+    if ( !IsOk() )
+        return false;
+
+    Save(m_docNode, out);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//  wxXmlSlice
+//-----------------------------------------------------------------------------
+
+bool wxXmlSlice::IsSameAs(const char *str) const
+{
+    size_t len = strlen(str);
+    return len == m_len && memcmp(m_str, str, len) == 0;
+}
+
+//-----------------------------------------------------------------------------
+//  wxXmlReader
+//-----------------------------------------------------------------------------
+
+namespace
+{
+
+inline bool IsXmlSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+} // anonymous namespace
+
+// expat is a push parser, it is stopped after each tag it reports and
+// resumed by the next call to Next(). It may still report the end of an
+// empty element after being stopped at its start and text is only complete
+// at the next tag, so events wait in a short queue. Their strings are kept
+// from one event to the next so they only grow to fit the largest seen.
+struct wxXmlReader::ParseContext
+{
+    struct Event
+    {
+        wxXmlReadEvent type;
+        wxXmlAtom atom;
+        int lineNo;
+        int depth;
+        std::string name;
+        std::string content;
+        std::string attrs;      // names and values, one after the other
+        std::vector<size_t> attrLens;
+    };
+
+    // Text, a start tag and the end of the same empty element.
+    enum { QUEUE_SIZE = 3 };
+
+    ParseContext()
+        : parser(NULL), buf(NULL), len(0), started(false), finished(false),
+          removeWhiteOnlyNodes(true), head(0), count(0), depth(0), textLineNo(-1)
+    {
+        current.type = wxXML_READ_EOF;
+        current.atom = wxXML_ATOM_UNKNOWN;
+        current.lineNo = -1;
+        current.depth = 0;
+    }
+
+    XML_Parser parser;
+    wxXmlInputBuffer input;     // used when a file is opened
+    const char *buf;
+    size_t len;
+    bool started;
+    bool finished;
+    bool removeWhiteOnlyNodes;
+
+    Event queue[QUEUE_SIZE];
+    size_t head, count;
+    int depth;
+
+    std::string text;           // character data since the last tag
+    int textLineNo;
+
+    Event current;
+    wxXmlSlice name, content;
+
+    Event& Push(wxXmlReadEvent type)
+    {
+        wxASSERT( count < QUEUE_SIZE );
+        Event& event = queue[(head + count++) % QUEUE_SIZE];
+        event.type = type;
+        event.atom = wxXML_ATOM_UNKNOWN;
+        event.lineNo = XML_GetCurrentLineNumber(parser);
+        event.name.clear();
+        event.content.clear();
+        event.attrs.clear();
+        event.attrLens.clear();
+        return event;
+    }
+
+    void AppendText(const char *s, int n)
+    {
+        if ( text.empty() )
+            textLineNo = XML_GetCurrentLineNumber(parser);
+        text.append(s, n);
+    }
+
+    // Queue any pending character data ahead of the tag being reported.
+    void EndText()
+    {
+        if ( text.empty() )
+            return;
+        bool whiteOnly = removeWhiteOnlyNodes;
+        for ( size_t i = 0; i < text.length() && whiteOnly; i++ )
+            whiteOnly = IsXmlSpace(text[i]);
+        if ( !whiteOnly )
+        {
+            Event& event = Push(wxXML_READ_TEXT);
+            event.lineNo = textLineNo;
+            event.content.swap(text);
+        }
+        text.clear();
+    }
+
+    // The end of an empty element is reported with the parser already
+    // stopped at its start.
+    void Stop()
+    {
+        XML_ParsingStatus status;
+        XML_GetParsingStatus(parser, &status);
+        if ( status.parsing == XML_PARSING )
+            XML_StopParser(parser, XML_TRUE);
+    }
+
+    void Start(int flags);
+};
+
+extern "C" {
+static void ReaderStartElementHnd(void *userData, const char *name, const char **atts)
+{
+    wxXmlReader::ParseContext *ctx = (wxXmlReader::ParseContext*)userData;
+    ctx->EndText();
+    wxXmlReader::ParseContext::Event& event = ctx->Push(wxXML_READ_START);
+    event.name.assign(name);
+    event.atom = wxXmlGetAtom(name, event.name.length());
+    for ( const char **a = atts; *a; a++ )
+    {
+        size_t n = strlen(*a);
+        event.attrs.append(*a, n);
+        event.attrLens.push_back(n);
+    }
+    ctx->Stop();
+}
+
+static void ReaderEndElementHnd(void *userData, const char *name)
+{
+    wxXmlReader::ParseContext *ctx = (wxXmlReader::ParseContext*)userData;
+    ctx->EndText();
+    wxXmlReader::ParseContext::Event& event = ctx->Push(wxXML_READ_END);
+    event.name.assign(name);
+    event.atom = wxXmlGetAtom(name, event.name.length());
+    ctx->Stop();
+}
+
+static void ReaderTextHnd(void *userData, const char *s, int len)
+{
+    ((wxXmlReader::ParseContext*)userData)->AppendText(s, len);
+}
+
+static void ReaderCommentHnd(void *userData, const char *data)
+{
+    wxXmlReader::ParseContext *ctx = (wxXmlReader::ParseContext*)userData;
+    ctx->EndText();
+    ctx->Push(wxXML_READ_COMMENT).content.assign(data);
+    ctx->Stop();
+}
+} // extern "C"
+
+void wxXmlReader::ParseContext::Start(int flags)
+{
+    removeWhiteOnlyNodes = (flags & wxXMLDOC_KEEP_WHITESPACE_NODES) == 0;
+    parser = gs_parserPool.Get();
+    XML_SetUserData(parser, (void*)this);
+    XML_SetElementHandler(parser, ReaderStartElementHnd, ReaderEndElementHnd);
+    XML_SetCharacterDataHandler(parser, ReaderTextHnd);
+    XML_SetCommentHandler(parser, ReaderCommentHnd);
+}
+
+wxXmlReader::wxXmlReader()
+    : m_ctx(NULL)
+{
+}
+
+wxXmlReader::~wxXmlReader()
+{
+    Close();
+}
+
+void wxXmlReader::Close()
+{
+    if ( m_ctx )
+    {
+        if ( m_ctx->parser )
+            gs_parserPool.Put(m_ctx->parser);
+        delete m_ctx;
+        m_ctx = NULL;
+    }
+}
+
+bool wxXmlReader::Open(const char *buf, size_t len, int flags)
+{
+    Close();
+    m_ctx = new ParseContext;
+    m_ctx->buf = buf;
+    m_ctx->len = len;
+    m_ctx->Start(flags);
+    return true;
+}
+
+bool wxXmlReader::Open(const wxString& filename, int flags)
+{
+    Close();
+    m_ctx = new ParseContext;
+    if ( !m_ctx->input.Open(filename) )
+    {
+        Close();
+        return false;
+    }
+    m_ctx->buf = m_ctx->input.GetData();
+    m_ctx->len = m_ctx->input.GetLength();
+    m_ctx->Start(flags);
+    return true;
+}
+
+wxXmlReadEvent wxXmlReader::Next()
+{
+    if ( !m_ctx )
+        return wxXML_READ_EOF;
+
+    ParseContext& ctx = *m_ctx;
+    if ( ctx.current.type == wxXML_READ_ERROR )
+        return wxXML_READ_ERROR;
+
+    while ( ctx.count == 0 && !ctx.finished )
+    {
+        XML_Status status;
+        if ( ctx.started )
+        {
+            status = XML_ResumeParser(ctx.parser);
+        }
+        else
+        {
+            ctx.started = true;
+            status = XML_Parse(ctx.parser, ctx.buf, (int)ctx.len, XML_TRUE);
+        }
+        if ( status == XML_STATUS_ERROR )
+        {
+            wxString error(XML_ErrorString(XML_GetErrorCode(ctx.parser)),
+                           *wxConvCurrent);
+            wxLogError(_("XML parsing error: '%s' at line %d"),
+                       error.c_str(),
+                       (int)XML_GetCurrentLineNumber(ctx.parser));
+            ctx.current.type = wxXML_READ_ERROR;
+            return wxXML_READ_ERROR;
+        }
+        if ( status == XML_STATUS_OK )
+        {
+            ctx.finished = true;
+            ctx.EndText();
+        }
+    }
+
+    if ( ctx.count == 0 )
+    {
+        ctx.current.type = wxXML_READ_EOF;
+        return wxXML_READ_EOF;
+    }
+
+    // Swap rather than copy, the queue slot keeps the old strings' memory.
+    ParseContext::Event& event = ctx.queue[ctx.head];
+    ctx.head = (ctx.head + 1) % ParseContext::QUEUE_SIZE;
+    ctx.count--;
+    std::swap(ctx.current.type, event.type);
+    std::swap(ctx.current.atom, event.atom);
+    std::swap(ctx.current.lineNo, event.lineNo);
+    ctx.current.name.swap(event.name);
+    ctx.current.content.swap(event.content);
+    ctx.current.attrs.swap(event.attrs);
+    ctx.current.attrLens.swap(event.attrLens);
+
+    switch ( ctx.current.type )
+    {
+        case wxXML_READ_START:
+            ctx.current.depth = ++ctx.depth;
+            break;
+        case wxXML_READ_END:
+            ctx.current.depth = ctx.depth--;
+            break;
+        default:
+            ctx.current.depth = ctx.depth;
+            break;
+    }
+    ctx.name = wxXmlSlice(ctx.current.name.data(), ctx.current.name.length());
+    ctx.content = wxXmlSlice(ctx.current.content.data(), ctx.current.content.length());
+    return ctx.current.type;
+}
+
+bool wxXmlReader::NextChild(int depth)
+{
+    for ( ;; )
+    {
+        switch ( Next() )
+        {
+            case wxXML_READ_START:
+                if ( GetDepth() == depth + 1 )
+                    return true;
+                break;
+            case wxXML_READ_END:
+                if ( GetDepth() == depth )
+                    return false;
+                break;
+            case wxXML_READ_TEXT:
+            case wxXML_READ_COMMENT:
+                break;
+            default:
+                return false;
+        }
+    }
+}
+
+wxString wxXmlReader::ReadElementText()
+{
+    wxCHECK_MSG( GetEvent() == wxXML_READ_START, wxString(),
+                 "not at a start tag" );
+
+    const int depth = GetDepth();
+    std::string text;
+    for ( ;; )
+    {
+        switch ( Next() )
+        {
+            case wxXML_READ_TEXT:
+                text.append(m_ctx->current.content);
+                break;
+            case wxXML_READ_END:
+                if ( GetDepth() == depth )
+                    return wxString::FromUTF8(text.data(), text.length());
+                break;
+            case wxXML_READ_START:
+            case wxXML_READ_COMMENT:
+                break;
+            default:
+                return wxString::FromUTF8(text.data(), text.length());
+        }
+    }
+}
+
+wxXmlReadEvent wxXmlReader::GetEvent() const
+{
+    return m_ctx ? m_ctx->current.type : wxXML_READ_EOF;
+}
+
+const wxXmlSlice& wxXmlReader::GetName() const
+{
+    static const wxXmlSlice s_empty;
+    return m_ctx ? m_ctx->name : s_empty;
+}
+
+wxXmlAtom wxXmlReader::GetAtom() const
+{
+    return m_ctx ? m_ctx->current.atom : wxXML_ATOM_UNKNOWN;
+}
+
+const wxXmlSlice& wxXmlReader::GetContent() const
+{
+    static const wxXmlSlice s_empty;
+    return m_ctx ? m_ctx->content : s_empty;
+}
+
+bool wxXmlReader::GetAttribute(const char *attrName, wxXmlSlice *value) const
+{
+    if ( !m_ctx || m_ctx->current.type != wxXML_READ_START )
+        return false;
+
+    const ParseContext::Event& event = m_ctx->current;
+    const size_t nameLen = strlen(attrName);
+    const char *p = event.attrs.data();
+    for ( size_t i = 0; i + 1 < event.attrLens.size(); i += 2 )
+    {
+        const size_t len = event.attrLens[i];
+        const size_t valueLen = event.attrLens[i + 1];
+        if ( len == nameLen && memcmp(p, attrName, len) == 0 )
+        {
+            if ( value )
+                *value = wxXmlSlice(p + len, valueLen);
+            return true;
+        }
+        p += len + valueLen;
+    }
+    return false;
+}
+
+wxString wxXmlReader::GetAttribute(const char *attrName,
+                                   const wxString& defaultVal) const
+{
+    wxXmlSlice value;
+    if ( GetAttribute(attrName, &value) )
+        return value.ToString();
+    return defaultVal;
+}
+
+int wxXmlReader::GetDepth() const
+{
+    return m_ctx ? m_ctx->current.depth : 0;
+}
+
+int wxXmlReader::GetLineNumber() const
+{
+    return m_ctx ? m_ctx->current.lineNo : -1;
+}
+
 /*static*/ wxVersionInfo wxXmlDocument::GetLibraryVersionInfo()
 {
     return wxVersionInfo("expat",
@@ -21,6 +21,10 @@
 #include "wx/list.h"
 #include "wx/versioninfo.h"
 
+#include <new>
+#include <string>
+#include <vector>
+
 #ifdef WXMAKINGDLL_XML
     #define WXDLLIMPEXP_XML WXEXPORT
 #elif defined(WXUSINGDLL)
@@ -33,6 +37,8 @@ class WXDLLIMPEXP_FWD_XML wxXmlNode;
 class WXDLLIMPEXP_FWD_XML wxXmlAttribute;
 class WXDLLIMPEXP_FWD_XML wxXmlDocument;
 class WXDLLIMPEXP_FWD_XML wxXmlIOHandler;
+class wxXmlSourceDocNode; // only defined in xml2.cpp
+struct wxXmlParsingContext;
 class WXDLLIMPEXP_FWD_BASE wxInputStream;
 class WXDLLIMPEXP_FWD_BASE wxOutputStream;
 
@@ -56,6 +62,165 @@ enum wxXmlNodeType
 };
 
 
+// Atoms for the tag and attribute names used when reading documents. Names
+// are looked up once, when they are set, so that code walking the tree can
+// compare a single integer. Names outside this list are wxXML_ATOM_UNKNOWN.
+// Keep in step with the name table in xml2.cpp.
+enum wxXmlAtom
+{
+    wxXML_ATOM_UNKNOWN = 0,
+    wxXML_ATOM_A,
+    wxXML_ATOM_ALT,
+    wxXML_ATOM_B,
+    wxXML_ATOM_BODY,
+    wxXML_ATOM_BR,
+    wxXML_ATOM_CENTER,
+    wxXML_ATOM_CLASS,
+    wxXML_ATOM_COLSPAN,
+    wxXML_ATOM_DIV,
+    wxXML_ATOM_ENTRIES,
+    wxXML_ATOM_ENTRY,
+    wxXML_ATOM_FILE,
+    wxXML_ATOM_GALLERIES,
+    wxXML_ATOM_GALLERY,
+    wxXML_ATOM_H1,
+    wxXML_ATOM_H2,
+    wxXML_ATOM_H3,
+    wxXML_ATOM_HEAD,
+    wxXML_ATOM_HREF,
+    wxXML_ATOM_HTML,
+    wxXML_ATOM_I,
+    wxXML_ATOM_ID,
+    wxXML_ATOM_IMG,
+    wxXML_ATOM_LI,
+    wxXML_ATOM_LINK,
+    wxXML_ATOM_META,
+    wxXML_ATOM_NAME,
+    wxXML_ATOM_NUMBER,
+    wxXML_ATOM_P,
+    wxXML_ATOM_PRE,
+    wxXML_ATOM_ROWSPAN,
+    wxXML_ATOM_SPAN,
+    wxXML_ATOM_SRC,
+    wxXML_ATOM_STYLE,
+    wxXML_ATOM_TABLE,
+    wxXML_ATOM_TBODY,
+    wxXML_ATOM_TD,
+    wxXML_ATOM_TH,
+    wxXML_ATOM_TITLE,
+    wxXML_ATOM_TR,
+    wxXML_ATOM_UL,
+    wxXML_ATOM_MAX
+};
+
+WXDLLIMPEXP_XML wxXmlAtom wxXmlGetAtom(const char *name, size_t len);
+WXDLLIMPEXP_XML wxXmlAtom wxXmlGetAtom(const wxString& name);
+WXDLLIMPEXP_XML const char *wxXmlGetAtomName(wxXmlAtom atom);
+
+
+// A vector that keeps its first N elements inside the object itself, so that
+// it only allocates when it grows past N.
+
+template <typename T, size_t N>
+class wxXmlSmallVector
+{
+public:
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    wxXmlSmallVector() : m_data(Inline()), m_size(0), m_capacity(N) {}
+    wxXmlSmallVector(const wxXmlSmallVector& other)
+        : m_data(Inline()), m_size(0), m_capacity(N) { Append(other); }
+    ~wxXmlSmallVector() { clear(); Release(); }
+
+    wxXmlSmallVector& operator=(const wxXmlSmallVector& other)
+    {
+        if ( this != &other )
+        {
+            clear();
+            Append(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[](size_t n) { return m_data[n]; }
+    const T& operator[](size_t n) const { return m_data[n]; }
+    T& back() { return m_data[m_size - 1]; }
+    const T& back() const { return m_data[m_size - 1]; }
+
+    iterator begin() { return m_data; }
+    iterator end() { return m_data + m_size; }
+    const_iterator begin() const { return m_data; }
+    const_iterator end() const { return m_data + m_size; }
+
+    void push_back(const T& item)
+    {
+        if ( m_size == m_capacity )
+        {
+            T copy(item); // item may be one of ours
+            Grow();
+            new (m_data + m_size) T(copy);
+        }
+        else
+            new (m_data + m_size) T(item);
+        ++m_size;
+    }
+
+    iterator erase(iterator pos)
+    {
+        for ( iterator i = pos; i + 1 != end(); ++i )
+            *i = *(i + 1);
+        m_data[--m_size].~T();
+        return pos;
+    }
+
+    void clear()
+    {
+        for ( size_t i = 0; i < m_size; i++ )
+            m_data[i].~T();
+        m_size = 0;
+    }
+
+private:
+    T *Inline() { return reinterpret_cast<T*>(m_inline); }
+
+    void Grow()
+    {
+        size_t capacity = m_capacity * 2;
+        T *data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        for ( size_t i = 0; i < m_size; i++ )
+        {
+            new (data + i) T(m_data[i]);
+            m_data[i].~T();
+        }
+        Release();
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+    void Release()
+    {
+        if ( m_data != Inline() )
+            ::operator delete(m_data);
+    }
+
+    void Append(const wxXmlSmallVector& other)
+    {
+        for ( const_iterator i = other.begin(); i != other.end(); ++i )
+            push_back(*i);
+    }
+
+    T *m_data;
+    size_t m_size;
+    size_t m_capacity;
+    alignas(T) unsigned char m_inline[N * sizeof(T)];
+};
+
+
 // Represents node property(ies).
 // Example: in <img src="hello.gif" id="3"/> "src" is property with value
 //          "hello.gif" and "id" is prop. with value "3".
@@ -63,26 +228,28 @@ enum wxXmlNodeType
 class WXDLLIMPEXP_XML wxXmlAttribute
 {
 public:
-    wxXmlAttribute() : m_next(NULL) {}
-    wxXmlAttribute(const wxString& name, const wxString& value,
-                  wxXmlAttribute *next = NULL)
-            : m_name(name), m_value(value), m_next(next) {}
-    virtual ~wxXmlAttribute() {}
+    wxXmlAttribute() : m_atom(wxXML_ATOM_UNKNOWN) {}
+    wxXmlAttribute(const wxString& name, const wxString& value)
+            : m_name(name), m_value(value), m_atom(wxXmlGetAtom(name)) {}
 
     const wxString& GetName() const { return m_name; }
+    wxXmlAtom GetAtom() const { return m_atom; }
     const wxString& GetValue() const { return m_value; }
-    wxXmlAttribute *GetNext() const { return m_next; }
 
-    void SetName(const wxString& name) { m_name = name; }
+    void SetName(const wxString& name)
+        { m_name = name; m_atom = wxXmlGetAtom(name); }
     void SetValue(const wxString& value) { m_value = value; }
-    void SetNext(wxXmlAttribute *next) { m_next = next; }
 
 private:
     wxString m_name;
     wxString m_value;
-    wxXmlAttribute *m_next;
+    wxXmlAtom m_atom;
 };
 
+// Attributes of an element, in document order. Most elements in the
+// documents we read have no more than two.
+typedef wxXmlSmallVector<wxXmlAttribute, 2> wxXmlAttributeList;
+
 #if WXWIN_COMPATIBILITY_2_8
     // NB: #define is used instead of typedef so that forward declarations
     //     continue to work
@@ -103,15 +270,18 @@ class WXDLLIMPEXP_XML wxXmlNode
 {
 public:
     wxXmlNode()
-        : m_attrs(NULL), m_parent(NULL), m_children(NULL), m_next(NULL),
-          m_lineNo(-1), m_noConversion(false)
+        : m_atom(wxXML_ATOM_UNKNOWN),
+          m_parent(NULL), m_children(NULL), m_lastChild(NULL),
+          m_next(NULL), m_prev(NULL),
+          m_lineNo(-1), m_noConversion(false), m_lazy(false),
+          m_srcBegin(0), m_srcEnd(0), m_cachedText(NULL)
     {
     }
 
     wxXmlNode(wxXmlNode *parent, wxXmlNodeType type,
               const wxString& name, const wxString& content = wxEmptyString,
-              wxXmlAttribute *attrs = NULL, wxXmlNode *next = NULL,
-              int lineNo = -1);
+              const wxXmlAttributeList& attrs = wxXmlAttributeList(),
+              wxXmlNode *next = NULL, int lineNo = -1);
 
     virtual ~wxXmlNode();
 
@@ -132,10 +302,14 @@ public:
     virtual bool RemoveChild(wxXmlNode *child);
     virtual void AddAttribute(const wxString& name, const wxString& value);
     virtual bool DeleteAttribute(const wxString& name);
+    // Replaces the value of an existing attribute, or adds it if not found.
+    void SetAttribute(const wxString& name, const wxString& value);
+    void ClearAttributes() { m_attrs.clear(); SetModified(); }
 
     // access methods:
     wxXmlNodeType GetType() const { return m_type; }
     const wxString& GetName() const { return m_name; }
+    wxXmlAtom GetAtom() const { return m_atom; }
     const wxString& GetContent() const { return m_content; }
 
     bool IsWhitespaceOnly_() const;
@@ -150,26 +324,78 @@ public:
 
     wxXmlNode *GetParent() const { return m_parent; }
     wxXmlNode *GetNext() const { return m_next; }
-    wxXmlNode *GetChildren() const { return m_children; }
-
-    wxXmlAttribute *GetAttributes() const { return m_attrs; }
+    wxXmlNode *GetPrevious() const { return m_prev; }
+    wxXmlNode *GetChildren() const
+        { if (m_lazy) ParseLazyChildren(); return m_children; }
+    wxXmlNode *GetLastChild() const
+        { if (m_lazy) ParseLazyChildren(); return m_lastChild; }
+
+    const wxXmlAttributeList& GetAttributes() const { return m_attrs; }
+    size_t GetAttributeCount() const { return m_attrs.size(); }
+    const wxXmlAttribute& GetAttributeAt(size_t n) const { return m_attrs[n]; }
+    wxXmlAttribute& GetAttributeAt(size_t n) { return m_attrs[n]; }
+    const wxXmlAttribute *FindAttribute(wxXmlAtom attr) const;
+    wxXmlAttribute *FindAttribute(wxXmlAtom attr);
+    const wxXmlAttribute *FindAttribute(const wxString& attrName) const;
     bool GetAttribute(const wxString& attrName, wxString *value) const;
     wxString GetAttribute(const wxString& attrName,
                           const wxString& defaultVal = wxEmptyString) const;
     bool HasAttribute(const wxString& attrName) const;
+    bool GetAttribute(wxXmlAtom attr, wxString *value) const;
+    wxString GetAttribute(wxXmlAtom attr,
+                          const wxString& defaultVal = wxEmptyString) const;
+    bool HasAttribute(wxXmlAtom attr) const;
 
     int GetLineNumber() const { return m_lineNo; }
 
     void SetType(wxXmlNodeType type) { m_type = type; }
-    void SetName(const wxString& name) { m_name = name; }
-    void SetContent(const wxString& con) { m_content = con; }
+    void SetName(const wxString& name)
+        { m_name = name; m_atom = wxXmlGetAtom(name); SetModified(); }
+    void SetContent(const wxString& con) { m_content = con; SetModified(); }
 
+    // These relink single pointers and leave the rest of the tree to the
+    // caller. AddChild(), InsertChild(), InsertChildAfter() and
+    // RemoveChild() keep every link right and take constant time.
     void SetParent(wxXmlNode *parent) { m_parent = parent; }
-    void SetNext(wxXmlNode *next) { m_next = next; }
-    void SetChildren(wxXmlNode *child) { m_children = child; }
-
-    void SetAttributes(wxXmlAttribute *attr) { m_attrs = attr; }
-    virtual void AddAttribute(wxXmlAttribute *attr);
+    void SetNext(wxXmlNode *next);
+    void SetChildren(wxXmlNode *child);
+
+    void SetAttributes(const wxXmlAttributeList& attrs)
+        { m_attrs = attrs; SetModified(); }
+
+    // The bytes an element was parsed from, kept when the document is loaded
+    // with wxXMLDOC_KEEP_SOURCE and until the element or anything inside it
+    // is changed. Such elements are saved by copying those bytes.
+    bool HasSourceRange() const { return m_srcEnd != 0; }
+    size_t GetSourceBegin() const { return m_srcBegin; }
+    size_t GetSourceEnd() const { return m_srcEnd; }
+    void SetSourceRange(size_t begin, size_t end)
+        { m_srcBegin = (wxUint32)begin; m_srcEnd = (wxUint32)end; }
+
+    // Drops the source range of the node and of the elements containing it.
+    // The methods above that change a node call it, it must be called after
+    // changing an attribute found with FindAttribute() or GetAttributeAt().
+    void SetModified();
+    // Drops the ranges of the whole subtree, for one taken out of the
+    // document they refer to.
+    void ClearSourceRanges();
+
+    // An element loaded with wxXMLDOC_LAZY whose children are still only
+    // its source range. They are parsed by the first call that needs them.
+    bool IsLazy() const { return m_lazy; }
+    void SetLazy() { m_lazy = true; }
+
+    // Text worked out by the caller from the node's subtree, kept until the
+    // node or anything inside it is changed, or NULL. A reference to it is
+    // only good until then.
+    const wxString *GetCachedText() const { return m_cachedText; }
+    void SetCachedText(const wxString& text) const;
+
+    // The buffer the source ranges refer to. Only the document node of a
+    // document loaded with wxXMLDOC_KEEP_SOURCE has one.
+    virtual const std::string *GetSourceBuffer() const { return NULL; }
+    // That document node itself, or NULL for any other node.
+    virtual const wxXmlSourceDocNode *GetSourceDocNode() const { return NULL; }
 
     // If true, don't do encoding conversion to improve efficiency - node content is ACII text
     bool GetNoConversion() const { return m_noConversion; }
@@ -186,37 +412,25 @@ public:
     wxDEPRECATED( inline void SetProperties(wxXmlAttribute *prop) );
 #endif // WXWIN_COMPATIBILITY_2_8
 
-    // The following three functions are backward compatibility, but because
-    // they were virtual, we must make it possible to override them. This
-    // is done by calling e.g. AddProperty() from AddAttribute(), so we have
-    // to keep AddProperty() even if 2.8 compatibility is off. To prevent
-    // old code from compiling in that case, we make them private and
-    // non-virtual. (This can be removed when WXWIN_COMPATIBILITY_2_8 is
-    // removed, we'll have just *Attribute versions then.)
-#if 0 // WXWIN_COMPATIBILITY_2_8
-    wxDEPRECATED_BUT_USED_INTERNALLY(
-        virtual void AddProperty(const wxString& name, const wxString& value) );
-    wxDEPRECATED_BUT_USED_INTERNALLY(
-        virtual bool DeleteProperty(const wxString& name) );
-    wxDEPRECATED_BUT_USED_INTERNALLY(
-        virtual void AddProperty(wxXmlAttribute *attr) );
-#else
-private:
-    void AddProperty(const wxString& name, const wxString& value);
-    bool DeleteProperty(const wxString& name);
-    void AddProperty(wxXmlAttribute *attr);
-#endif // WXWIN_COMPATIBILITY_2_8/!WXWIN_COMPATIBILITY_2_8
 
 private:
     wxXmlNodeType m_type;
     wxString m_name;
+    wxXmlAtom m_atom;
     wxString m_content;
-    wxXmlAttribute *m_attrs;
-    wxXmlNode *m_parent, *m_children, *m_next;
+    wxXmlAttributeList m_attrs;
+    wxXmlNode *m_parent, *m_children, *m_lastChild, *m_next, *m_prev;
     int m_lineNo; // line number in original file, or -1
     bool m_noConversion; // don't do encoding conversion - node is plain text
+    bool m_lazy; // children not parsed yet
+    wxUint32 m_srcBegin, m_srcEnd; // byte range in the source, or 0, 0
+    mutable wxString *m_cachedText; // owned, or NULL
+
+    friend struct wxXmlParsingContext;
 
     void DoCopy(const wxXmlNode& node);
+    void ParseLazyChildren() const;
+    void SetVerbatimChildren(const std::string& source, const wxString& encoding);
 };
 
 #if 0 // WXWIN_COMPATIBILITY_2_8
@@ -235,6 +449,73 @@ inline void wxXmlNode::SetProperties(wxXmlAttribute *prop)
 #endif // WXWIN_COMPATIBILITY_2_8
 
 
+// When wxXmlWalk() calls the visitor: as a node is entered, before its
+// children, or as it is left, after them.
+enum wxXmlWalkOrder
+{
+    wxXML_WALK_ENTER = 1,
+    wxXML_WALK_LEAVE = 2,
+    wxXML_WALK_BOTH = wxXML_WALK_ENTER | wxXML_WALK_LEAVE
+};
+
+// Returned by the visitor. wxXML_WALK_SKIP on entering a node passes over
+// its children, wxXML_WALK_STOP ends the walk.
+enum wxXmlWalkAction
+{
+    wxXML_WALK_CONTINUE,
+    wxXML_WALK_SKIP,
+    wxXML_WALK_STOP
+};
+
+// Walks first, the siblings following it and everything below them, in
+// document order, without recursion or allocation. The visitor is called as
+// visit(wxXmlNode *node, wxXmlWalkOrder order) for the orders asked for. It
+// may change the node it is given and anything below it, the next node is
+// only looked up once it returns. Returns the node the walk was stopped at,
+// or NULL.
+template <typename Visitor>
+wxXmlNode *wxXmlWalk(wxXmlNode *first, Visitor visit,
+                     int orders = wxXML_WALK_ENTER)
+{
+    if ( !first )
+        return NULL;
+
+    wxXmlNode * const top = first->GetParent();
+    wxXmlNode *node = first;
+    for ( ;; )
+    {
+        wxXmlWalkAction action = wxXML_WALK_CONTINUE;
+        if ( orders & wxXML_WALK_ENTER )
+        {
+            action = visit(node, wxXML_WALK_ENTER);
+            if ( action == wxXML_WALK_STOP )
+                return node;
+        }
+        if ( action != wxXML_WALK_SKIP && node->GetChildren() )
+        {
+            node = node->GetChildren();
+            continue;
+        }
+
+        // leave this node, and its parents for as long as it is the last
+        for ( ;; )
+        {
+            if ( (orders & wxXML_WALK_LEAVE) &&
+                    visit(node, wxXML_WALK_LEAVE) == wxXML_WALK_STOP )
+                return node;
+            if ( node->GetNext() )
+            {
+                node = node->GetNext();
+                break;
+            }
+            node = node->GetParent();
+            if ( node == top )
+                return NULL;
+        }
+    }
+}
+
+
 
 // special indentation value for wxXmlDocument::Save
 #define wxXML_NO_INDENTATION           (-1)
@@ -243,9 +524,36 @@ inline void wxXmlNode::SetProperties(wxXmlAttribute *prop)
 enum wxXmlDocumentLoadFlag
 {
     wxXMLDOC_NONE = 0,
-    wxXMLDOC_KEEP_WHITESPACE_NODES = 1
+    wxXMLDOC_KEEP_WHITESPACE_NODES = 1,
+    // Keep a copy of UTF-8 input so unchanged elements are saved to a
+    // std::string just as they were written. Only used together with
+    // wxXMLDOC_KEEP_WHITESPACE_NODES, so no text is lost from the copy.
+    wxXMLDOC_KEEP_SOURCE = 2,
+    // Together with wxXMLDOC_KEEP_SOURCE, elements accepted by the document's
+    // lazy filter are skipped over, their children are only parsed if they
+    // are asked for. Unchanged, they are saved as their source bytes.
+    wxXMLDOC_LAZY = 4,
+    // List the <a> elements with an href attribute, see GetAnchors().
+    wxXMLDOC_INDEX_ANCHORS = 8,
+    // Load(wxInputStream&) reads the stream and runs expat over it 1024
+    // bytes at a time, as wxWidgets does, instead of reading it whole. Only
+    // kept so the two can be timed against each other. wxXMLDOC_KEEP_SOURCE
+    // and wxXMLDOC_LAZY are ignored and the native parser is not used.
+    wxXMLDOC_READ_CHUNKS = 16
+};
+
+// The parser used by wxXmlDocument::Load(). The native one is a tokenizer
+// for UTF-8 XHTML that resolves the common HTML entities, other input is
+// still given to expat.
+enum wxXmlParserKind
+{
+    wxXML_PARSER_EXPAT,
+    wxXML_PARSER_NATIVE
 };
 
+// Decides, from its name and attributes, whether an element is loaded lazily.
+typedef bool (*wxXmlLazyFilter)(const wxXmlNode *element);
+
 // flags for wxXmlDocument::Save
 enum wxXmlDocumentSaveFlag
 {
@@ -275,12 +583,22 @@ public:
                       const wxString& encoding = wxT("UTF-8"), int flags = wxXMLDOC_NONE);
     virtual bool Load(wxInputStream& stream,
                       const wxString& encoding = wxT("UTF-8"), int flags = wxXMLDOC_NONE);
+    // Parses a document held in memory with a single pass of the parser.
+    // Loading from a file maps it into memory, or reads it in one go, and
+    // uses this.
+    bool Load(const char *buf, size_t len,
+              const wxString& encoding = wxT("UTF-8"), int flags = wxXMLDOC_NONE);
 
     // Saves document as .xml file.
     virtual bool Save(const wxString& filename, int indentstep = 2,
         int flags = wxXMLDOC_SAVE_DEFAULT) const;
     virtual bool Save(wxOutputStream& stream, int indentstep = 2,
         int flags = wxXMLDOC_SAVE_DEFAULT) const;
+    // Appends the markup of the document, or of a single node and its
+    // subtree, to out as UTF-8. Same output as Save(stream) with no
+    // indentation and no declaration, without going through a stream.
+    bool Save(std::string& out) const;
+    static void Save(const wxXmlNode *node, std::string& out);
 
     bool IsOk() const { return GetRoot() != NULL; }
 
@@ -305,6 +623,12 @@ public:
     void SetVersion(const wxString& version) { m_version = version; }
     void SetFileEncoding(const wxString& encoding) { m_fileEncoding = encoding; }
     void AppendToProlog(wxXmlNode *node);
+    // Used by Load() with wxXMLDOC_LAZY.
+    void SetLazyFilter(wxXmlLazyFilter filter) { m_lazyFilter = filter; }
+    // With wxXMLDOC_INDEX_ANCHORS, the <a href> elements found by Load(), in
+    // document order. Those inside lazy elements are not included. The list
+    // is not kept up to date, nodes deleted since must not be looked at.
+    const std::vector<wxXmlNode*>& GetAnchors() const { return m_anchors; }
 
 #if !wxUSE_UNICODE
     // Returns encoding of in-memory representation of the document
@@ -316,19 +640,133 @@ public:
 
     static wxVersionInfo GetLibraryVersionInfo();
 
+    // Chooses the parser for all documents, set once at start up.
+    static void SetParser(wxXmlParserKind parser) { ms_parser = parser; }
+    static wxXmlParserKind GetParser() { return ms_parser; }
+
 private:
+    static wxXmlParserKind ms_parser;
+
     wxString   m_version;
     wxString   m_fileEncoding;
 #if !wxUSE_UNICODE
     wxString   m_encoding;
 #endif
     wxXmlNode *m_docNode;
+    wxXmlLazyFilter m_lazyFilter;
+    std::vector<wxXmlNode*> m_anchors;
 
     void DoCopy(const wxXmlDocument& doc);
+    // Loads from buf, or with a stream from that, see wxXMLDOC_READ_CHUNKS.
+    bool DoLoad(const char *buf, size_t len, wxInputStream *stream,
+                const wxString& encoding, int flags);
 
     DECLARE_CLASS(wxXmlDocument)
 };
 
+
+// ----------------------------------------------------------------------------
+// UTF-8 slices
+// ----------------------------------------------------------------------------
+
+// A run of UTF-8 bytes owned by someone else, as returned by wxXmlReader. It
+// is not NUL terminated and is only valid for as long as its owner says.
+
+class WXDLLIMPEXP_XML wxXmlSlice
+{
+public:
+    wxXmlSlice() : m_str(NULL), m_len(0) {}
+    wxXmlSlice(const char *str, size_t len) : m_str(str), m_len(len) {}
+
+    const char *data() const { return m_str; }
+    size_t length() const { return m_len; }
+    bool empty() const { return m_len == 0; }
+
+    // Compare with a NUL terminated UTF-8 (usually ASCII) string.
+    bool IsSameAs(const char *str) const;
+
+    // Widen to a wxString, only done when a caller asks for one.
+    wxString ToString() const
+        { return m_len ? wxString::FromUTF8Unchecked(m_str, m_len) : wxString(); }
+
+private:
+    const char *m_str;
+    size_t      m_len;
+};
+
+inline bool operator==(const wxXmlSlice& slice, const char *str)
+    { return slice.IsSameAs(str); }
+inline bool operator!=(const wxXmlSlice& slice, const char *str)
+    { return !slice.IsSameAs(str); }
+
+
+// ----------------------------------------------------------------------------
+// Pull reader
+// ----------------------------------------------------------------------------
+
+// Returned by wxXmlReader::Next().
+enum wxXmlReadEvent
+{
+    wxXML_READ_ERROR = -1,
+    wxXML_READ_EOF = 0,
+    wxXML_READ_START,           // a start tag, name and attributes are set
+    wxXML_READ_END,             // an end tag, the name is set
+    wxXML_READ_TEXT,            // character data, including CDATA sections
+    wxXML_READ_COMMENT
+};
+
+// Reads a document one event at a time, without building a tree. Adjacent
+// character data is returned as one text event and whitespace only text is
+// dropped unless wxXMLDOC_KEEP_WHITESPACE_NODES is given, as when loading a
+// wxXmlDocument. The strings returned are UTF-8 and are only valid until the
+// next call to Next(). Memory use depends on the largest tag or run of text,
+// not on the size of the document.
+
+class WXDLLIMPEXP_XML wxXmlReader
+{
+public:
+    wxXmlReader();
+    ~wxXmlReader();
+
+    // The buffer is not copied and must outlive the reader.
+    bool Open(const char *buf, size_t len, int flags = wxXMLDOC_NONE);
+    bool Open(const wxString& filename, int flags = wxXMLDOC_NONE);
+    void Close();
+
+    wxXmlReadEvent Next();
+
+    // Reads on to the next start tag at depth + 1, that is to the next child
+    // of the element at depth, passing over anything else. Returns false,
+    // having read its end tag, once the element at depth has no more
+    // children. Use 0 for the root element.
+    bool NextChild(int depth);
+
+    // Called after a start tag, reads up to and including the matching end
+    // tag, returning all the text in between.
+    wxString ReadElementText();
+
+    wxXmlReadEvent GetEvent() const;
+    const wxXmlSlice& GetName() const;
+    wxXmlAtom GetAtom() const;
+    // The text or comment.
+    const wxXmlSlice& GetContent() const;
+    bool GetAttribute(const char *attrName, wxXmlSlice *value) const;
+    wxString GetAttribute(const char *attrName,
+                          const wxString& defaultVal = wxEmptyString) const;
+    // Depth of the element started or ended, the root element is 1.
+    int GetDepth() const;
+    int GetLineNumber() const;
+
+    // Parser state, only used by the expat callbacks.
+    struct ParseContext;
+
+private:
+    ParseContext *m_ctx;
+
+    wxXmlReader(const wxXmlReader&);
+    wxXmlReader& operator=(const wxXmlReader&);
+};
+
 #endif // wxUSE_XML
 
 #endif // _WX_XML_H_
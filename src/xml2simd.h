@@ -0,0 +1,346 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Name:        xml2simd.h
+ * Project:     tfp_fill: Private utility to create Matthews TFP database
+ * Purpose:     Vector scans used by the xml2 load and save routines.
+ * Author:      Nick Matthews
+ * Created:     18th October 2026
+ * Copyright:   Copyright (c) 2026, Nick Matthews.
+ * Licence:     GNU GPLv3
+ *
+ *  tfp_fill is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  tfp_fill is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with tfp_fill.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+
+*/
+
+// Only included by xml2.cpp. The instruction set is chosen when compiling:
+// AVX2 if the compiler targets it, else SSE2, which every x86-64 compiler
+// targets, else plain loops. Widening and narrowing always use 16 byte
+// SSE2 registers, the packing instructions don't cross AVX2 lanes.
+
+#ifndef _WX_XML2SIMD_H_
+#define _WX_XML2SIMD_H_
+
+#include <stddef.h>
+#include <type_traits>
+
+#if defined(__AVX2__)
+    #define wxXML_SIMD_AVX2 1
+    #define wxXML_SIMD_SSE2 1
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define wxXML_SIMD_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && defined(wxXML_SIMD_SSE2)
+    #include <intrin.h>
+#endif
+
+namespace wxXmlSimd
+{
+
+// Index of the lowest set bit, mask must not be zero.
+inline unsigned CountTrailingZeros(unsigned mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return i;
+#else
+    unsigned i = 0;
+    for ( ; !(mask & 1); mask >>= 1 )
+        ++i;
+    return i;
+#endif
+}
+
+// True for the characters OutputEscapedString() replaces with an entity.
+template <typename CharT>
+inline bool NeedsEscape(CharT c, bool attribute)
+{
+    switch ( c )
+    {
+        case '<':
+        case '>':
+        case '&':
+        case '\r':
+            return true;
+        case '"':
+        case '\t':
+        case '\n':
+            return attribute;
+    }
+    return false;
+}
+
+#ifdef wxXML_SIMD_SSE2
+
+#ifdef wxXML_SIMD_AVX2
+typedef __m256i Vec;
+
+inline Vec Load(const void *p) { return _mm256_loadu_si256((const __m256i *)p); }
+inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+inline Vec Zero() { return _mm256_setzero_si256(); }
+inline unsigned Mask(Vec v) { return (unsigned)_mm256_movemask_epi8(v); }
+
+// Compares and broadcasts for lanes of 1, 2 or 4 bytes, matching the width
+// of the characters being scanned.
+template <size_t N> struct Lane;
+template <> struct Lane<1>
+{
+    static Vec Set(unsigned c) { return _mm256_set1_epi8((char)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+};
+template <> struct Lane<2>
+{
+    static Vec Set(unsigned c) { return _mm256_set1_epi16((short)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi16(a, b); }
+};
+template <> struct Lane<4>
+{
+    static Vec Set(unsigned c) { return _mm256_set1_epi32((int)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi32(a, b); }
+};
+#else // wxXML_SIMD_SSE2
+typedef __m128i Vec;
+
+inline Vec Load(const void *p) { return _mm_loadu_si128((const __m128i *)p); }
+inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+inline Vec Zero() { return _mm_setzero_si128(); }
+inline unsigned Mask(Vec v) { return (unsigned)_mm_movemask_epi8(v); }
+
+template <size_t N> struct Lane;
+template <> struct Lane<1>
+{
+    static Vec Set(unsigned c) { return _mm_set1_epi8((char)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+};
+template <> struct Lane<2>
+{
+    static Vec Set(unsigned c) { return _mm_set1_epi16((short)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi16(a, b); }
+};
+template <> struct Lane<4>
+{
+    static Vec Set(unsigned c) { return _mm_set1_epi32((int)c); }
+    static Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi32(a, b); }
+};
+#endif
+
+#define wxXML_SIMD 1
+
+#endif // wxXML_SIMD_SSE2
+
+// Returns the first character in [s, end) that needs escaping, or end.
+// Works on UTF-8 bytes as well as on wide characters.
+template <typename CharT>
+const CharT *FindEscape(const CharT *s, const CharT *end, bool attribute)
+{
+#ifdef wxXML_SIMD
+    typedef Lane<sizeof(CharT)> L;
+    const ptrdiff_t perVec = sizeof(Vec) / sizeof(CharT);
+    if ( end - s >= perVec )
+    {
+        const Vec lt = L::Set('<'), gt = L::Set('>'),
+                  amp = L::Set('&'), cr = L::Set('\r'),
+                  quot = L::Set('"'), tab = L::Set('\t'), nl = L::Set('\n');
+        for ( ; end - s >= perVec; s += perVec )
+        {
+            const Vec v = Load(s);
+            Vec hit = Or(Or(L::Eq(v, lt), L::Eq(v, gt)),
+                         Or(L::Eq(v, amp), L::Eq(v, cr)));
+            if ( attribute )
+                hit = Or(hit, Or(L::Eq(v, quot), Or(L::Eq(v, tab), L::Eq(v, nl))));
+            const unsigned mask = Mask(hit);
+            if ( mask )
+                return s + CountTrailingZeros(mask) / sizeof(CharT);
+        }
+    }
+#endif
+    for ( ; s != end; ++s )
+    {
+        if ( NeedsEscape(*s, attribute) )
+            return s;
+    }
+    return end;
+}
+
+// Returns the first of the bytes a, b or c in [s, end), or end.
+inline const char *FindFirstOf(const char *s, const char *end,
+                               char a, char b, char c)
+{
+#ifdef wxXML_SIMD
+    typedef Lane<1> L;
+    const ptrdiff_t perVec = sizeof(Vec);
+    if ( end - s >= perVec )
+    {
+        const Vec va = L::Set((unsigned char)a), vb = L::Set((unsigned char)b),
+                  vc = L::Set((unsigned char)c);
+        for ( ; end - s >= perVec; s += perVec )
+        {
+            const Vec v = Load(s);
+            const unsigned mask =
+                Mask(Or(L::Eq(v, va), Or(L::Eq(v, vb), L::Eq(v, vc))));
+            if ( mask )
+                return s + CountTrailingZeros(mask);
+        }
+    }
+#endif
+    for ( ; s != end; ++s )
+    {
+        if ( *s == a || *s == b || *s == c )
+            return s;
+    }
+    return end;
+}
+
+// The value of a character as an unsigned number, whatever its type.
+template <typename CharT>
+inline unsigned CodeOf(CharT c)
+{
+    return static_cast<typename std::make_unsigned<CharT>::type>(c);
+}
+
+// Returns the number of ASCII characters at the start of [s, end).
+template <typename CharT>
+size_t AsciiLength(const CharT *s, const CharT *end)
+{
+    const CharT *p = s;
+#ifdef wxXML_SIMD
+    typedef Lane<sizeof(CharT)> L;
+    const ptrdiff_t perVec = sizeof(Vec) / sizeof(CharT);
+    if ( end - p >= perVec )
+    {
+        const unsigned all = sizeof(Vec) == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+        const Vec high = L::Set(~0x7Fu);
+        const Vec zero = Zero();
+        for ( ; end - p >= perVec; p += perVec )
+        {
+            const unsigned mask = ~Mask(L::Eq(And(Load(p), high), zero)) & all;
+            if ( mask )
+                return p - s + CountTrailingZeros(mask) / sizeof(CharT);
+        }
+    }
+#endif
+    while ( p != end && CodeOf(*p) < 0x80 )
+        ++p;
+    return p - s;
+}
+
+// Copies n ASCII bytes to wide characters.
+template <typename WCharT>
+void WidenAscii(const char *s, size_t n, WCharT *out)
+{
+    size_t i = 0;
+#ifdef wxXML_SIMD
+    const __m128i zero = _mm_setzero_si128();
+    for ( ; i + 16 <= n; i += 16 )
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *o = (__m128i *)(out + i);
+        if ( sizeof(WCharT) == 2 )
+        {
+            _mm_storeu_si128(o, lo);
+            _mm_storeu_si128(o + 1, hi);
+        }
+        else
+        {
+            _mm_storeu_si128(o, _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128(o + 1, _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128(o + 2, _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128(o + 3, _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+#endif
+    for ( ; i < n; ++i )
+        out[i] = WCharT(s[i]);
+}
+
+// Copies n wide characters, all known to be ASCII, to bytes.
+template <typename WCharT>
+void NarrowAscii(const WCharT *s, size_t n, char *out)
+{
+    size_t i = 0;
+#ifdef wxXML_SIMD
+    for ( ; i + 16 <= n; i += 16 )
+    {
+        const __m128i *p = (const __m128i *)(s + i);
+        __m128i v;
+        if ( sizeof(WCharT) == 2 )
+        {
+            v = _mm_packus_epi16(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+        }
+        else
+        {
+            const __m128i lo = _mm_packs_epi32(_mm_loadu_si128(p),
+                                               _mm_loadu_si128(p + 1));
+            const __m128i hi = _mm_packs_epi32(_mm_loadu_si128(p + 2),
+                                               _mm_loadu_si128(p + 3));
+            v = _mm_packus_epi16(lo, hi);
+        }
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+#endif
+    for ( ; i < n; ++i )
+        out[i] = char(s[i]);
+}
+
+// Converts the UTF-8 in [s, end) to wide characters, surrogate pairs where
+// they are 16 bits. out must have room for end - s characters, the end of
+// the output is returned. The input must already be valid UTF-8, as it is
+// when it comes from expat.
+template <typename WCharT>
+WCharT *Utf8ToWide(const char *s, const char *end, WCharT *out)
+{
+    while ( s != end )
+    {
+        const size_t n = AsciiLength(s, end);
+        WidenAscii(s, n, out);
+        s += n;
+        out += n;
+        if ( s == end )
+            break;
+
+        unsigned c = CodeOf(*s++);
+        int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        if ( extra )
+            c &= 0x3F >> extra;
+        for ( ; extra && s != end; --extra )
+            c = (c << 6) | (CodeOf(*s++) & 0x3F);
+
+        if ( sizeof(WCharT) == 2 && c >= 0x10000 )
+        {
+            c -= 0x10000;
+            *out++ = WCharT(0xD800 + (c >> 10));
+            *out++ = WCharT(0xDC00 + (c & 0x3FF));
+        }
+        else
+        {
+            *out++ = WCharT(c);
+        }
+    }
+    return out;
+}
+
+} // namespace wxXmlSimd
+
+#endif // _WX_XML2SIMD_H_